@@ -0,0 +1,93 @@
+// Beeper for the sound timer, driven from the SDL audio thread
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "audio.h"
+
+#define SAMPLE_RATE 44100
+#define AMPLITUDE 28000
+#define FREQUENCY 440
+#define WAVE_BITS 8 // wavetable of 256 samples, indexed by the top bits of the phase
+#define RAMP_SAMPLES 64 // attack/release, ~1.5 ms
+
+static int16_t wavetable[1 << WAVE_BITS];
+static SDL_AudioDeviceID device;
+static uint32_t phase_step; // phase increment per sample, a full period is 2^32
+
+// written by the emulation thread, read by the callback
+static atomic_int gate;
+
+// written by the callback, read by the stats printer
+static atomic_ulong callbacks, underruns;
+static Uint64 last_callback, buffer_ticks; // performance counter ticks, callback-only
+
+static void audio_callback(void *userdata, Uint8 *stream, int len){
+    (void)userdata;
+    int16_t *out = (int16_t *)stream;
+    int samples = len / sizeof(int16_t);
+    static uint32_t phase;
+    static int volume; // 0..RAMP_SAMPLES
+
+    // a callback arriving more than half a buffer late means the device ran dry
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(last_callback && now - last_callback > buffer_ticks + buffer_ticks / 2)
+        atomic_fetch_add_explicit(&underruns, 1, memory_order_relaxed);
+    last_callback = now;
+    atomic_fetch_add_explicit(&callbacks, 1, memory_order_relaxed);
+
+    int target = atomic_load_explicit(&gate, memory_order_relaxed) ? RAMP_SAMPLES : 0;
+    for(int i = 0; i < samples; i++){
+        if(volume < target) volume++;
+        else if(volume > target) volume--;
+        if(volume == 0){
+            out[i] = 0;
+            phase = 0; // every beep starts at the same point of the wave
+            continue;
+        }
+        out[i] = wavetable[phase >> (32 - WAVE_BITS)] * volume / RAMP_SAMPLES;
+        phase += phase_step;
+    }
+}
+
+int audio_init(int buffer_samples){
+    for(int i = 0; i < (1 << WAVE_BITS); i++)
+        wavetable[i] = (int16_t)(AMPLITUDE * sin(2 * M_PI * i / (1 << WAVE_BITS)));
+
+    SDL_AudioSpec desiredSpec, obtainedSpec;
+    SDL_zero(desiredSpec);
+    desiredSpec.freq = SAMPLE_RATE;
+    desiredSpec.format = AUDIO_S16SYS; // Signed 16-bit audio in system byte order
+    desiredSpec.channels = 1; // Mono
+    desiredSpec.samples = buffer_samples; // Smaller is lower latency but more prone to underruns
+    desiredSpec.callback = audio_callback;
+
+    // the driver may pick a different rate or buffer size, the generator adapts to what it got
+    device = SDL_OpenAudioDevice(NULL, 0, &desiredSpec, &obtainedSpec,
+                                 SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if(device == 0){
+        fprintf(stderr, "Failed to open audio: %s\n", SDL_GetError());
+        return 0;
+    }
+    phase_step = (uint32_t)((double)FREQUENCY / obtainedSpec.freq * 4294967296.0);
+    buffer_ticks = SDL_GetPerformanceFrequency() * obtainedSpec.samples / obtainedSpec.freq;
+
+    // the device runs for the whole session, silence is just the gate being closed
+    SDL_PauseAudioDevice(device, 0);
+    return 1;
+}
+
+void audio_quit(void){
+    if(device)
+        SDL_CloseAudioDevice(device);
+    device = 0;
+}
+
+void audio_set_gate(int on){
+    atomic_store_explicit(&gate, on, memory_order_relaxed);
+}
+
+void audio_print_stats(FILE *out){
+    fprintf(out, "audio: %lu callbacks, %lu underruns\n",
+            atomic_load(&callbacks), atomic_load(&underruns));
+}
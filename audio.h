@@ -0,0 +1,16 @@
+// Beeper for the sound timer, driven from the SDL audio thread
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdio.h>
+
+#define AUDIO_DEFAULT_BUFFER 256 // samples per callback, ~6 ms at 44.1 kHz
+
+// Open and start the audio device, returns 0 on failure
+int audio_init(int buffer_samples);
+void audio_quit(void);
+// Beep while `on`, the callback ramps the volume so toggling never clicks
+void audio_set_gate(int on);
+void audio_print_stats(FILE *out);
+
+#endif
@@ -0,0 +1,74 @@
+// Backend registry and what the headless backends share, see backend.h
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "backend.h"
+
+static const backend_t *backends[] = {
+#ifndef CHIP8_NO_SDL
+    &backend_sdl,
+#endif
+    &backend_null,
+    &backend_term,
+};
+#define NUM_BACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+const backend_t *backend_find(const char *name){
+    for(int i = 0; i < NUM_BACKENDS; i++)
+        if(strcmp(backends[i]->name, name) == 0)
+            return backends[i];
+    return NULL;
+}
+
+void backend_print(void){
+    for(int i = 0; i < NUM_BACKENDS; i++)
+        printf("  %-5s %s%s\n", backends[i]->name, backends[i]->what,
+               strcmp(backends[i]->name, BACKEND_DEFAULT) == 0 ? " (default)" : "");
+}
+
+static int wake_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t quit_signalled;
+
+static void on_quit_signal(int sig){
+    (void)sig;
+    quit_signalled = 1;
+    backend_pipe_wake(); // write() is async-signal-safe
+}
+
+int backend_pipe_init(void){
+    if(pipe(wake_pipe) != 0){
+        printf("Error: could not create the wakeup pipe\n");
+        return 0;
+    }
+    // a full pipe already holds a wakeup, neither end ever blocks
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_quit_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    return 1;
+}
+
+void backend_pipe_wait(int fd, int ms){
+    struct pollfd fds[2] = { { wake_pipe[0], POLLIN, 0 }, { fd, POLLIN, 0 } };
+    if(poll(fds, fd < 0 ? 1 : 2, ms) > 0 && (fds[0].revents & POLLIN)){
+        char drain[64];
+        while(read(wake_pipe[0], drain, sizeof(drain)) > 0)
+            ;
+    }
+}
+
+void backend_pipe_wake(void){
+    if(wake_pipe[1] >= 0){
+        ssize_t ignored = write(wake_pipe[1], "", 1);
+        (void)ignored;
+    }
+}
+
+int backend_quit_signalled(void){
+    return quit_signalled;
+}
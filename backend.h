@@ -0,0 +1,50 @@
+// Video, audio and input for the frontend behind one interface, picked with -backend
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdio.h>
+#include "handoff.h"
+
+/* One per host API. init(), quit(), present(), poll_input() and wait() run
+   on the main thread; audio_gate() on the emulation thread and wake() on
+   any. Every entry is set, a backend without audio has an audio_gate()
+   that does nothing. */
+typedef struct {
+    const char *name;
+    const char *what; // one line for -backend list
+    int (*init)(int audio_buffer); // 0 on failure, after printing why
+    void (*quit)(void);
+    /* Show `f`. `fresh` is 0 when it was passed before; the backend shows it
+       again anyway when its output was lost (e.g. the window was exposed).
+       Returns 1 when it presented. */
+    int (*present)(const frame_t *f, int fresh);
+    void (*audio_gate)(int on); // beep while `on`
+    // Queue the keys pressed and released since the last call, 0 when the user asked to quit
+    int (*poll_input)(inputq_t *q);
+    // Sleep until input arrives, wake() is called or `ms` pass
+    void (*wait)(int ms);
+    void (*wake)(void);
+    void (*print_stats)(FILE *out);
+} backend_t;
+
+extern const backend_t backend_null, backend_term;
+#ifndef CHIP8_NO_SDL
+extern const backend_t backend_sdl;
+#define BACKEND_DEFAULT "sdl"
+#else
+#define BACKEND_DEFAULT "null" // make SDL=0
+#endif
+
+// By name, NULL when this build has no such backend
+const backend_t *backend_find(const char *name);
+// Every backend of this build on one line each, for -backend list
+void backend_print(void);
+
+/* For the backends without a window: a self-pipe behind wait() and wake(),
+   and SIGINT/SIGTERM turned into a quit request. */
+int backend_pipe_init(void); // 0 on failure
+void backend_pipe_wait(int fd, int ms); // returns early too when `fd` is readable, -1 for none
+void backend_pipe_wake(void);
+int backend_quit_signalled(void);
+
+#endif
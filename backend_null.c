@@ -0,0 +1,40 @@
+// Null backend: nothing shown, heard or read, for CI and server runs; SIGINT/SIGTERM quit
+#include "backend.h"
+
+static unsigned long long presented;
+
+static int null_init(int audio_buffer){
+    (void)audio_buffer;
+    return backend_pipe_init();
+}
+
+static void null_quit(void){
+}
+
+static int null_present(const frame_t *f, int fresh){
+    (void)f;
+    presented += fresh;
+    return fresh;
+}
+
+static void null_audio_gate(int on){
+    (void)on;
+}
+
+static int null_poll_input(inputq_t *q){
+    (void)q;
+    return !backend_quit_signalled();
+}
+
+static void null_wait(int ms){
+    backend_pipe_wait(-1, ms);
+}
+
+static void null_print_stats(FILE *out){
+    fprintf(out, "null: %llu frames presented\n", presented);
+}
+
+const backend_t backend_null = {
+    "null", "no display, audio or input, runs until the ROM exits or SIGINT",
+    null_init, null_quit, null_present, null_audio_gate, null_poll_input, null_wait, backend_pipe_wake, null_print_stats,
+};
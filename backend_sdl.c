@@ -0,0 +1,228 @@
+// SDL backend: a window, the beeper through the SDL audio device, keys from the window
+#include <stdint.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "backend.h"
+#include "audio.h"
+#include "sched.h"
+
+// SDL globals
+static SDL_Window* sdlWindow = NULL;
+static SDL_Renderer* sdlRenderer = NULL;
+static SDL_Texture* sdlTexture = NULL; // 64x32
+static SDL_Texture* sdlTextureHires = NULL; // 128x64, shown while the machine is in hi-res mode
+
+// Mapping SDL scancodes to CHIP-8 keys (adjust as needed for your desired layout)
+static uint8_t sdl_key_map[SDL_NUM_SCANCODES]; // Max number of scancodes
+
+// what is on the display
+static uint64_t presented_hash; // chip8_screen_hash() of the frame on the display
+static int present_forced = 1; // window exposed or resized, present even if the frame did not change
+
+
+static void setup_key_map(void) {
+    // Initialize all to 0xFF (invalid key)
+    for (int i = 0; i < SDL_NUM_SCANCODES; ++i) {
+        sdl_key_map[i] = INPUT_NO_KEY;
+    }
+
+    // Map common keyboard keys to CHIP-8 hex keypad
+    // CHIP-8 Layout:
+    // 1 2 3 C
+    // 4 5 6 D
+    // 7 8 9 E
+    // A 0 B F
+
+    // My suggested mapping (can be customized):
+    // 1 2 3 4
+    // Q W E R
+    // A S D F
+    // Z X C V
+
+    sdl_key_map[SDL_SCANCODE_1] = 0x1;
+    sdl_key_map[SDL_SCANCODE_2] = 0x2;
+    sdl_key_map[SDL_SCANCODE_3] = 0x3;
+    sdl_key_map[SDL_SCANCODE_4] = 0xC; // C
+
+    sdl_key_map[SDL_SCANCODE_Q] = 0x4;
+    sdl_key_map[SDL_SCANCODE_W] = 0x5;
+    sdl_key_map[SDL_SCANCODE_E] = 0x6;
+    sdl_key_map[SDL_SCANCODE_R] = 0xD; // D
+
+    sdl_key_map[SDL_SCANCODE_A] = 0x7;
+    sdl_key_map[SDL_SCANCODE_S] = 0x8;
+    sdl_key_map[SDL_SCANCODE_D] = 0x9;
+    sdl_key_map[SDL_SCANCODE_F] = 0xE; // E
+
+    sdl_key_map[SDL_SCANCODE_Z] = 0xA; // A
+    sdl_key_map[SDL_SCANCODE_X] = 0x0;
+    sdl_key_map[SDL_SCANCODE_C] = 0xB; // B
+    sdl_key_map[SDL_SCANCODE_V] = 0xF; // F
+}
+
+// - and = halve and double IPF, F1 toggles turbo, hold Tab to fast-forward,
+// hold Backspace to rewind, F5 saves and F9 loads the quick save state
+static int hotkey(SDL_Scancode scancode) {
+    switch (scancode) {
+        case SDL_SCANCODE_MINUS: return HOTKEY_SLOWER;
+        case SDL_SCANCODE_EQUALS: return HOTKEY_FASTER;
+        case SDL_SCANCODE_F1: return HOTKEY_TURBO;
+        case SDL_SCANCODE_TAB: return HOTKEY_FAST_FORWARD;
+        case SDL_SCANCODE_BACKSPACE: return HOTKEY_REWIND;
+        case SDL_SCANCODE_F5: return HOTKEY_SAVE_STATE;
+        case SDL_SCANCODE_F9: return HOTKEY_LOAD_STATE;
+        default: return HOTKEY_NONE;
+    }
+}
+
+static int sdl_init(int audio_buffer)
+{
+    // Init SDL, only what the backend uses
+    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_EVENTS) < 0){
+        printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    // Create window
+    sdlWindow = SDL_CreateWindow("CHIP-8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                 640, 320, SDL_WINDOW_SHOWN); // 10x scale
+    if (sdlWindow == NULL) {
+        printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    // Create renderer
+    sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (sdlRenderer == NULL) {
+        printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    // Create texture for the screen (format is ARGB8888 for easier pixel manipulation)
+    sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING, SCRN_WIDTH, SCRN_HEIGHT);
+    sdlTextureHires = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STREAMING, SCRN_HIRES_WIDTH, SCRN_HIRES_HEIGHT);
+    if (sdlTexture == NULL || sdlTextureHires == NULL) {
+        printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    // Clear renderer
+    SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 255); // Black background
+    SDL_RenderClear(sdlRenderer);
+    SDL_RenderPresent(sdlRenderer);
+
+    // Set up the keyboard mapping for SDL scancodes to CHIP-8 keys
+    setup_key_map();
+
+    return audio_init(audio_buffer);
+}
+
+static void sdl_quit(void)
+{
+    // --- Cleanup SDL Resources ---
+    SDL_DestroyTexture(sdlTexture);
+    SDL_DestroyTexture(sdlTextureHires);
+    SDL_DestroyRenderer(sdlRenderer);
+    SDL_DestroyWindow(sdlWindow);
+    audio_quit(); // Close the audio device
+    SDL_Quit(); // Quit SDL subsystems
+}
+
+// Upload a frame from the emulation thread and present it, waits for vsync
+static void draw_graphics(const frame_t *f) {
+    // what each texture holds, to upload only what changed
+    static uint64_t shown[2][SCRN_PLANES][SCRN_HIRES_HEIGHT][2];
+    static int uploaded[2];
+
+    // Nothing to do if the frame is the one already on screen (e.g. a sprite drawn and erased again)
+    if(f->hash == presented_hash && !present_forced)
+        return;
+
+    // Upload only the span of rows that differ, locked pixels are write-only so every row in it is rewritten
+    SDL_Texture *texture = f->hires ? sdlTextureHires : sdlTexture;
+    int height = f->hires ? SCRN_HIRES_HEIGHT : SCRN_HEIGHT;
+    int first = -1, last = -1;
+    for(int y = 0; y < height; y++){
+        if(uploaded[f->hires] && memcmp(f->SCREEN[0][y], shown[f->hires][0][y], sizeof(f->SCREEN[0][y])) == 0 &&
+           memcmp(f->SCREEN[1][y], shown[f->hires][1][y], sizeof(f->SCREEN[1][y])) == 0)
+            continue;
+        if(first < 0)
+            first = y;
+        last = y;
+    }
+    if(first >= 0){
+        SDL_Rect rect = {0, first, f->hires ? SCRN_HIRES_WIDTH : SCRN_WIDTH, last - first + 1};
+        void *pixels;
+        int pitch;
+        if(SDL_LockTexture(texture, &rect, &pixels, &pitch) == 0){
+            // On pixels become white, off pixels black (SIMD expansion of the packed rows)
+            chip8_planes_to_argb(f->SCREEN, f->hires, pixels, pitch, first, rect.h);
+            SDL_UnlockTexture(texture);
+            memcpy(shown[f->hires], f->SCREEN, sizeof(f->SCREEN));
+            uploaded[f->hires] = 1;
+        }
+    }
+
+    // Clear the renderer
+    SDL_RenderClear(sdlRenderer);
+    // Copy the texture to the renderer (scales it to fit the window)
+    SDL_RenderCopy(sdlRenderer, texture, NULL, NULL);
+    // Present the renderer, waits for vsync
+    SDL_RenderPresent(sdlRenderer);
+
+    presented_hash = f->hash;
+    present_forced = 0;
+}
+
+static int sdl_present(const frame_t *f, int fresh) {
+    // Present at most once per published frame, however many DRW/CLS ran during it
+    if(!fresh && !present_forced)
+        return 0;
+    draw_graphics(f);
+    return 1;
+}
+
+// Window events, keys are queued for the emulation thread. Returns 0 when the window was closed
+static int sdl_poll_input(inputq_t *q) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            return 0; // Signal to quit the emulator
+        }
+
+        if (event.type == SDL_WINDOWEVENT &&
+            (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+            present_forced = 1; // window contents were lost
+        }
+
+        if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+            SDL_Scancode scancode = event.key.keysym.scancode;
+            // SDL stamps events in milliseconds of SDL_GetTicks(), carry that over to our clock
+            uint32_t age_ms = SDL_GetTicks() - event.key.timestamp;
+            uint64_t now = sched_now_ns();
+            uint64_t time_ns = age_ms < 1000 && age_ms * 1000000ULL < now ? now - age_ms * 1000000ULL : now;
+            input_event_t ev = { event.type == SDL_KEYDOWN ? INPUT_KEY_DOWN : INPUT_KEY_UP, event.key.repeat,
+                                 sdl_key_map[scancode], hotkey(scancode), time_ns };
+            if (ev.keypad != INPUT_NO_KEY || ev.hotkey != HOTKEY_NONE)
+                inputq_push(q, &ev); // a full queue drops the key, it holds several seconds of typing
+        }
+    }
+    return 1;
+}
+
+static void sdl_wait(int ms) {
+    SDL_WaitEventTimeout(NULL, ms);
+}
+
+static void sdl_wake(void) {
+    // SDL_PushEvent() is safe from any thread
+    SDL_Event wake = { .type = SDL_USEREVENT };
+    SDL_PushEvent(&wake);
+}
+
+const backend_t backend_sdl = {
+    "sdl", "a window with the keyboard and a beeper",
+    sdl_init, sdl_quit, sdl_present, audio_set_gate, sdl_poll_input, sdl_wait, sdl_wake, audio_print_stats,
+};
@@ -0,0 +1,184 @@
+// Terminal backend: the display in braille on an ANSI terminal, keys from stdin, the bell for the beeper
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <termios.h>
+#include <unistd.h>
+#include "backend.h"
+#include "sched.h"
+
+/* Terminals send bytes, not key releases: a key counts as held until this
+   long after its last byte. Autorepeat keeps a held key down once it starts,
+   after the first repeat delay it may let go for a moment. */
+#define TERM_KEY_HOLD_MS 200
+#define TERM_KEYS (16 + HOTKEY_LOAD_STATE + 1) // keypad keys, then hotkeys
+
+// cells are 2x4 dots, U+2800 plus one bit per dot
+#define CELL_COLUMNS (SCRN_HIRES_WIDTH / 2)
+#define CELL_ROWS (SCRN_HIRES_HEIGHT / 4)
+static const uint8_t dot_bits[4][2] = { { 0x01, 0x08 }, { 0x02, 0x10 }, { 0x04, 0x20 }, { 0x40, 0x80 } };
+
+static struct termios saved_termios;
+static int active; // between init and quit, the cursor is hidden
+static int raw_input; // stdin is a terminal in raw mode
+static uint64_t shown_hash;
+static int shown_hires = -1; // nothing drawn yet
+static unsigned long long presented, bytes_written;
+static uint64_t held_until[TERM_KEYS]; // 0 when up
+static int gate_open; // emulation thread only
+
+// the same layout as the SDL keyboard: 1234 / QWER / ASDF / ZXCV, indexed by keypad key
+static const char keypad_chars[] = "x123qweasdzc4rfv";
+// what follows ESC for F1, F5 and F9; other sequences (arrows and so on) are skipped
+static const struct { const char *seq; int hotkey; } function_keys[] = {
+    { "OP", HOTKEY_TURBO }, { "[15~", HOTKEY_SAVE_STATE }, { "[20~", HOTKEY_LOAD_STATE },
+};
+
+static void restore_terminal(void){
+    if(!active)
+        return;
+    active = 0;
+    if(raw_input)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    raw_input = 0;
+    printf("\x1b[?25h\n"); // cursor back on, below the display
+    fflush(stdout);
+}
+
+static int term_init(int audio_buffer){
+    (void)audio_buffer;
+    if(!backend_pipe_init())
+        return 0;
+    if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0){
+        // byte by byte without echo; Ctrl-C arrives as a byte and quits through poll_input()
+        struct termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_iflag &= ~(IXON | ICRNL);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        raw_input = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+    active = 1;
+    atexit(restore_terminal); // error_out_of_stack() exits
+    printf("\x1b[?25l\x1b[2J"); // hide the cursor, clear
+    fflush(stdout);
+    return 1;
+}
+
+static void term_quit(void){
+    restore_terminal();
+}
+
+static int term_present(const frame_t *f, int fresh){
+    if(!fresh || (f->hash == shown_hash && f->hires == shown_hires))
+        return 0;
+    int width = f->hires ? SCRN_HIRES_WIDTH : SCRN_WIDTH, height = f->hires ? SCRN_HIRES_HEIGHT : SCRN_HEIGHT;
+    // each cell is 3 bytes of UTF-8, each line ends in a newline; one write for the whole display
+    static char out[16 + CELL_ROWS * (CELL_COLUMNS * 3 + 1)];
+    int len = sprintf(out, f->hires != shown_hires ? "\x1b[2J\x1b[H" : "\x1b[H");
+    for(int row = 0; row < height; row += 4){
+        for(int col = 0; col < width; col += 2){
+            uint8_t bits = 0;
+            for(int dy = 0; dy < 4; dy++){
+                for(int dx = 0; dx < 2; dx++){
+                    int x = col + dx;
+                    uint64_t bit = 1ULL << (63 - (x & 63)); // any plane lights the dot
+                    if((f->SCREEN[0][row + dy][x >> 6] | f->SCREEN[1][row + dy][x >> 6]) & bit)
+                        bits |= dot_bits[dy][dx];
+                }
+            }
+            out[len++] = (char)0xE2;
+            out[len++] = (char)(0xA0 | bits >> 6);
+            out[len++] = (char)(0x80 | (bits & 0x3F));
+        }
+        out[len++] = '\n';
+    }
+    fwrite(out, 1, len, stdout);
+    fflush(stdout);
+    bytes_written += len;
+    presented++;
+    shown_hash = f->hash;
+    shown_hires = f->hires;
+    return 1;
+}
+
+static void term_audio_gate(int on){
+    // no tone to hold, the bell rings once as each beep starts
+    if(on && !gate_open){
+        ssize_t ignored = write(STDOUT_FILENO, "\a", 1);
+        (void)ignored;
+    }
+    gate_open = on;
+}
+
+// press `index` (keypad key, or 16 + hotkey), or keep holding it
+static void press(inputq_t *q, int index, uint64_t now){
+    input_event_t ev = { INPUT_KEY_DOWN, held_until[index] != 0,
+                         index < 16 ? index : INPUT_NO_KEY, index < 16 ? HOTKEY_NONE : index - 16, now };
+    inputq_push(q, &ev);
+    held_until[index] = now + TERM_KEY_HOLD_MS * 1000000ULL;
+}
+
+static int term_poll_input(inputq_t *q){
+    if(backend_quit_signalled())
+        return 0;
+    uint64_t now = sched_now_ns();
+    unsigned char buf[64];
+    ssize_t n = raw_input ? read(STDIN_FILENO, buf, sizeof(buf)) : 0;
+    for(ssize_t i = 0; i < n; i++){
+        unsigned char ch = buf[i];
+        const char *key = ch ? strchr(keypad_chars, tolower(ch)) : NULL;
+        if(ch == 3) // Ctrl-C
+            return 0;
+        if(key)
+            press(q, key - keypad_chars, now);
+        else if(ch == '-')
+            press(q, 16 + HOTKEY_SLOWER, now);
+        else if(ch == '=')
+            press(q, 16 + HOTKEY_FASTER, now);
+        else if(ch == '\t')
+            press(q, 16 + HOTKEY_FAST_FORWARD, now);
+        else if(ch == 0x7F || ch == '\b')
+            press(q, 16 + HOTKEY_REWIND, now);
+        else if(ch == 0x1B && i + 1 < n && (buf[i + 1] == '[' || buf[i + 1] == 'O')){
+            // an escape sequence: parameters below 0x40, then one final byte
+            ssize_t len = 1;
+            while(i + 1 + len < n && buf[i + 1 + len] < 0x40)
+                len++;
+            if(i + 1 + len < n)
+                len++;
+            for(int k = 0; k < (int)(sizeof(function_keys) / sizeof(function_keys[0])); k++)
+                if(strlen(function_keys[k].seq) == (size_t)len && memcmp(&buf[i + 1], function_keys[k].seq, len) == 0)
+                    press(q, 16 + function_keys[k].hotkey, now);
+            i += len;
+        }
+    }
+
+    // let go of the keys no byte came for
+    for(int index = 0; index < TERM_KEYS; index++){
+        if(held_until[index] && now >= held_until[index]){
+            input_event_t ev = { INPUT_KEY_UP, 0, index < 16 ? index : INPUT_NO_KEY, index < 16 ? HOTKEY_NONE : index - 16, now };
+            inputq_push(q, &ev);
+            held_until[index] = 0;
+        }
+    }
+    return 1;
+}
+
+static void term_wait(int ms){
+    // keys held need their release on time
+    for(int index = 0; index < TERM_KEYS; index++)
+        if(held_until[index] && ms > TERM_KEY_HOLD_MS / 4)
+            ms = TERM_KEY_HOLD_MS / 4;
+    backend_pipe_wait(raw_input ? STDIN_FILENO : -1, ms);
+}
+
+static void term_print_stats(FILE *out){
+    fprintf(out, "term: %llu frames drawn, %llu bytes written\n", presented, bytes_written);
+}
+
+const backend_t backend_term = {
+    "term", "braille on an ANSI terminal, keys from stdin (held for 200 ms), the bell for beeps; Ctrl-C quits",
+    term_init, term_quit, term_present, term_audio_gate, term_poll_input, term_wait, backend_pipe_wake, term_print_stats,
+};
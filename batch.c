@@ -0,0 +1,467 @@
+// Headless batch runner: runs many ROM jobs across all cores without SDL
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "movie.h"
+#include "quirks.h"
+#include "disasm.h"
+#include "trace.h"
+#include "input.h"
+
+#define MAX_JOBS_LINE 1024
+
+/* A job file has one job per line:
+
+       <rom path> [seed] [input script]
+
+   An input script is a movie (see movie.h): at its simplest one keypad
+   change per line, in frame order,
+
+       <frame> <key 0-F> <1 = down | 0 = up>
+
+   Movies recorded by the emulator also carry the seed, IPF, quirks and
+   length they were recorded with, which override -seed, -ipf, -quirks and
+   -frames, and cycle counts that are checked as the movie plays. ROMs run
+   with the -quirks profile, else the one -quirkdb lists for them, else modern.
+
+   Lines starting with '#' are ignored in the job file.
+
+   A save state (chip8_save_state, e.g. from -checkpoint) can be given in
+   place of a ROM; the job then resumes it, with its own RNG state, and runs
+   -frames more frames or up to -cycles opcodes in total.
+*/
+
+typedef struct {
+    char *rom;
+    char *script;
+    uint32_t seed;
+
+    // results
+    int ok;
+    int halted;
+    int exited; // 00FD, a clean stop rather than a fault
+    const char *diverged; // -jitdiff: first state field where the JIT and the interpreter disagree
+    uint64_t diverged_frame;
+    int desynced; // a recorded cycle count in the movie did not match
+    uint64_t desync_frame;
+    uint64_t frames, cycles;
+    uint64_t idle_cycles; // part of cycles skipped in spin loops
+    uint64_t screen_hash;
+    double seconds;
+    uint8_t V[16];
+    uint16_t PC, I;
+    uint8_t SP, DT, ST;
+} job_t;
+
+/* Each worker owns a contiguous slice of the job array packed into one
+   atomic word: low 32 bits are the next job to take (head), high 32 bits are
+   one past the last (tail). The owner takes from the head, thieves take from
+   the tail; both go through a CAS on the same word, so a job can never be
+   handed out twice. */
+typedef struct {
+    _Atomic uint64_t range;
+    pthread_t thread;
+    int id;
+} worker_t;
+
+static job_t *jobs;
+static int num_jobs;
+static worker_t *workers;
+static int num_workers;
+
+static uint64_t run_frames = 600; // default: 10 seconds of emulated time
+static int frames_set = 0;        // -frames given, movies do not override it
+static uint64_t run_cycles = 0;   // when set, run for this many opcodes instead of run_frames
+static int ipf = 10;              // opcodes per 60 Hz frame, same as the windowed emulator
+static int use_bcache = 1;        // run from pre-decoded blocks
+static int use_jit = 0;           // compile hot blocks to native code
+static int jit_diff = 0;          // run every job on the JIT and the plain interpreter in lockstep
+static int prewarm = 1;           // decode the reachable code before the first frame, see disasm.h
+static int idle_skip = 1;         // fast-forward spin loops on DT or the keys, see chip8_run()
+static const char *checkpoint_dir = NULL; // save every job's final state here as <job index>.c8s
+static const char *trace_dir = NULL;      // log every opcode to <dir>/<job index>.c8t
+static const char *profile_prefix = NULL; // write <prefix>.<job index>.folded/.json (PROFILE=1 builds)
+static int quirks = -1;                   // -quirks for every job, -1 to go by the database
+static const char *quirk_db = NULL;       // per-ROM quirks, see quirks.h
+
+static uint64_t pack_range(uint32_t head, uint32_t tail){
+    return (uint64_t)tail << 32 | head;
+}
+
+static int take_own(worker_t *w){
+    uint64_t r = atomic_load(&w->range);
+    for(;;){
+        uint32_t head = r & 0xffffffff, tail = r >> 32;
+        if(head >= tail) return -1;
+        if(atomic_compare_exchange_weak(&w->range, &r, pack_range(head + 1, tail)))
+            return head;
+    }
+}
+
+static int steal(worker_t *victim){
+    uint64_t r = atomic_load(&victim->range);
+    for(;;){
+        uint32_t head = r & 0xffffffff, tail = r >> 32;
+        if(head >= tail) return -1;
+        if(atomic_compare_exchange_weak(&victim->range, &r, pack_range(head, tail - 1)))
+            return tail - 1;
+    }
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(const char *path, long *size){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    uint8_t *data = malloc(*size > 0 ? *size : 1);
+    if(fread(data, 1, *size, f) != (size_t)*size){
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// first piece of machine state that differs between a and b, NULL if none
+static const char *state_diff(const chip8_t *a, const chip8_t *b){
+    if(memcmp(a->V, b->V, sizeof(a->V))) return "V";
+    if(a->PC != b->PC) return "PC";
+    if(a->I != b->I) return "I";
+    if(a->SP != b->SP || memcmp(a->STACK, b->STACK, sizeof(a->STACK))) return "stack";
+    if(a->DT != b->DT || a->ST != b->ST) return "timers";
+    if(a->cycles != b->cycles) return "cycles";
+    if(a->halted != b->halted || a->waiting_for_key != b->waiting_for_key) return "halt/wait";
+    if(a->rng != b->rng) return "rng";
+    if(memcmp(a->MEMORY, b->MEMORY, sizeof(a->MEMORY))) return "memory";
+    if(memcmp(a->SCREEN, b->SCREEN, sizeof(a->SCREEN))) return "screen";
+    return NULL;
+}
+
+static void run_job(chip8_t *m, chip8_t *ref, job_t *job){
+    long rom_size;
+    uint8_t *rom = read_file(job->rom, &rom_size);
+    if(rom == NULL){
+        fprintf(stderr, "Error: could not read ROM file '%s'\n", job->rom);
+        return;
+    }
+
+    chip8_movie_t movie = {0};
+    int next_event = 0, ref_next_event = 0;
+    if(job->script && !chip8_movie_load(&movie, job->script)){
+        free(rom);
+        return;
+    }
+    if(movie.seed)
+        job->seed = movie.seed;
+    int job_ipf = movie.ipf ? movie.ipf : ipf, ref_ipf = job_ipf;
+    uint64_t job_frames = movie.frames && !frames_set ? movie.frames : run_frames;
+
+    int loaded, job_quirks = movie.has_quirks ? movie.quirks : quirks;
+    if(rom_size >= 4 && memcmp(rom, CHIP8_STATE_MAGIC, 4) == 0){
+        // resume a checkpoint instead of booting a ROM, its quirks come with it
+        loaded = chip8_load_state(m, job->rom) && (ref == NULL || chip8_load_state(ref, job->rom));
+        if(loaded && job_quirks < 0)
+            job_quirks = m->quirks;
+    } else {
+        if(ref){
+            init_machine(ref);
+            chip8_seed(ref, job->seed);
+            load_rom_data(ref, rom, rom_size);
+        }
+        init_machine(m);
+        chip8_seed(m, job->seed);
+        loaded = load_rom_data(m, rom, rom_size);
+        if(!loaded)
+            fprintf(stderr, "Error: ROM file '%s' is too large for memory. Size: %ld bytes\n", job->rom, rom_size);
+        if(loaded && job_quirks < 0 && quirk_db)
+            job_quirks = chip8_quirks_lookup(quirk_db, chip8_memory_hash(m));
+        if(job_quirks < 0)
+            job_quirks = CHIP8_QUIRKS_MODERN; // the machines are reused, never inherit the last job's
+    }
+    if(!loaded){
+        free(rom);
+        chip8_movie_free(&movie);
+        return;
+    }
+    chip8_set_quirks(m, job_quirks);
+    if(ref)
+        chip8_set_quirks(ref, job_quirks);
+    if(prewarm)
+        chip8_prewarm(m);
+    if(profile_prefix)
+        chip8_profile_enable(m);
+    chip8_trace_t *trace = NULL;
+    if(trace_dir){
+        char path[MAX_JOBS_LINE];
+        snprintf(path, sizeof(path), "%s/%d.c8t", trace_dir, (int)(job - jobs));
+        trace = chip8_trace_open(path);
+    }
+    if(movie.rom_hash && movie.rom_hash != chip8_memory_hash(m))
+        fprintf(stderr, "Warning: movie '%s' was recorded with a different ROM than '%s'\n", job->script, job->rom);
+
+    m->idle_cycles = 0;
+    double start = now_seconds();
+    uint64_t frame = 0;
+    for(;;){
+        if(run_cycles ? m->cycles >= run_cycles : frame >= job_frames)
+            break;
+
+        // keypad changes land on the opcode they were recorded at
+        chip8_input_t keys, ref_keys;
+        chip8_input_clear(&keys);
+        int in_sync = chip8_movie_input(&movie, &next_event, frame, m, &job_ipf, &keys);
+        if(ref){
+            chip8_input_clear(&ref_keys);
+            chip8_movie_input(&movie, &ref_next_event, frame, ref, &ref_ipf, &ref_keys);
+        }
+
+        int budget = job_ipf;
+        if(run_cycles && run_cycles - m->cycles < (uint64_t)budget)
+            budget = run_cycles - m->cycles;
+        chip8_input_run(m, budget, &keys, trace);
+        if(!(in_sync && chip8_input_in_sync(&keys)) && !job->desynced){
+            job->desynced = 1;
+            job->desync_frame = frame;
+        }
+        chip8_tick_timers(m);
+        frame++;
+
+        if(ref){
+            chip8_input_run(ref, budget, &ref_keys, NULL);
+            chip8_tick_timers(ref);
+            if((job->diverged = state_diff(m, ref)) != NULL){
+                job->diverged_frame = frame;
+                break;
+            }
+        }
+
+        if(m->halted)
+            break;
+        // FX0A with no input left to ever satisfy it
+        if(m->waiting_for_key && m->key_press_buffer == -1 && next_event == movie.num_events)
+            break;
+    }
+    job->seconds = now_seconds() - start;
+    chip8_trace_close(trace);
+
+    job->ok = 1;
+    job->halted = m->halted;
+    job->exited = m->exited;
+    job->frames = frame;
+    job->cycles = m->cycles;
+    job->idle_cycles = m->idle_cycles;
+    job->screen_hash = chip8_screen_hash(m);
+    memcpy(job->V, m->V, sizeof(job->V));
+    job->PC = m->PC;
+    job->I = m->I;
+    job->SP = m->SP;
+    job->DT = m->DT;
+    job->ST = m->ST;
+
+    if(checkpoint_dir){
+        char path[MAX_JOBS_LINE];
+        snprintf(path, sizeof(path), "%s/%d.c8s", checkpoint_dir, (int)(job - jobs));
+        chip8_save_state(m, path);
+    }
+    if(profile_prefix){
+        char prefix[MAX_JOBS_LINE];
+        snprintf(prefix, sizeof(prefix), "%s.%d", profile_prefix, (int)(job - jobs));
+        chip8_profile_write(m, prefix);
+        chip8_profile_disable(m); // the next job starts from zero
+    }
+
+    free(rom);
+    chip8_movie_free(&movie);
+}
+
+static void *worker_main(void *arg){
+    worker_t *w = arg;
+    chip8_t *m = calloc(1, sizeof(chip8_t)); // reused for every job this worker runs
+    chip8_t *ref = jit_diff ? calloc(1, sizeof(chip8_t)) : NULL; // plain interpreter to check the JIT against
+    m->idle_skip = idle_skip; // not on ref, so -jitdiff checks the skipping too
+    if(use_bcache)
+        chip8_bcache_enable(m);
+    if(use_jit && !chip8_jit_enable(m))
+        fprintf(stderr, "Warning: no JIT for this host (or executable memory is refused), jobs run interpreted\n");
+
+    for(;;){
+        int j = take_own(w);
+        // own slice is empty, try to steal from the others
+        for(int k = 1; j < 0 && k < num_workers; k++)
+            j = steal(&workers[(w->id + k) % num_workers]);
+        if(j < 0)
+            break;
+        run_job(m, ref, &jobs[j]);
+    }
+
+    chip8_jit_disable(m);
+    chip8_bcache_disable(m);
+    free(m);
+    free(ref);
+    return NULL;
+}
+
+static void add_job(const char *rom, uint32_t seed, const char *script){
+    static int cap = 0;
+    if(num_jobs == cap){
+        cap = cap ? cap * 2 : 64;
+        jobs = realloc(jobs, cap * sizeof(job_t));
+    }
+    job_t *job = &jobs[num_jobs++];
+    memset(job, 0, sizeof(*job));
+    job->rom = strdup(rom);
+    job->script = script ? strdup(script) : NULL;
+    job->seed = seed;
+}
+
+static int load_job_file(const char *path){
+    FILE *f = fopen(path, "r");
+    if(f == NULL){
+        fprintf(stderr, "Error: could not open job file '%s'\n", path);
+        return 0;
+    }
+    char line[MAX_JOBS_LINE];
+    while(fgets(line, sizeof(line), f)){
+        char rom[MAX_JOBS_LINE], script[MAX_JOBS_LINE];
+        unsigned seed = 1;
+        if(line[0] == '#') continue;
+        int fields = sscanf(line, "%s %u %s", rom, &seed, script);
+        if(fields < 1) continue;
+        add_job(rom, seed, fields == 3 ? script : NULL);
+    }
+    fclose(f);
+    return 1;
+}
+
+static void print_results(void){
+    printf("# rom\tseed\tstatus\tframes\tcycles\tscreen_hash\tPC\tI\tSP\tDT\tST\tV0-VF\tcycles_per_sec\n");
+    for(int j = 0; j < num_jobs; j++){
+        job_t *job = &jobs[j];
+        if(!job->ok){
+            printf("%s\t%u\terror\n", job->rom, job->seed);
+            continue;
+        }
+        char status[64];
+        if(job->diverged)
+            snprintf(status, sizeof(status), "diverged:%s@frame%llu", job->diverged, (unsigned long long)job->diverged_frame);
+        else if(job->desynced)
+            snprintf(status, sizeof(status), "desync@frame%llu", (unsigned long long)job->desync_frame);
+        else
+            snprintf(status, sizeof(status), "%s", job->exited ? "exited" : job->halted ? "halted" : "ok");
+        printf("%s\t%u\t%s\t%llu\t%llu\t%016llx\t%03x\t%03x\t%u\t%u\t%u\t",
+               job->rom, job->seed, status,
+               (unsigned long long)job->frames, (unsigned long long)job->cycles,
+               (unsigned long long)job->screen_hash, job->PC, job->I, job->SP, job->DT, job->ST);
+        for(int i = 0; i < 16; i++)
+            printf("%02x", job->V[i]);
+        printf("\t%.0f\n", job->seconds > 0 ? job->cycles / job->seconds : 0.0);
+    }
+}
+
+int main(int argc, char* argv[]){
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t seed = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc){
+            run_frames = strtoull(argv[++i], NULL, 10);
+            frames_set = 1;
+        }
+        else if(strcmp(argv[i], "-cycles") == 0 && i + 1 < argc) run_cycles = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-ipf") == 0 && i + 1 < argc) ipf = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-nocache") == 0) use_bcache = 0;
+        else if(strcmp(argv[i], "-noprewarm") == 0) prewarm = 0;
+        else if(strcmp(argv[i], "-noidle") == 0) idle_skip = 0;
+        else if(strcmp(argv[i], "-jit") == 0) use_jit = 1;
+        else if(strcmp(argv[i], "-jitdiff") == 0) use_jit = jit_diff = 1;
+        else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) checkpoint_dir = argv[++i];
+        else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc) trace_dir = argv[++i];
+        else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc) profile_prefix = argv[++i];
+        else if(strcmp(argv[i], "-quirks") == 0 && i + 1 < argc){
+            if(strcmp(argv[++i], "list") == 0){
+                chip8_quirks_print();
+                return 0;
+            }
+            if((quirks = chip8_quirks_parse(argv[i])) < 0){
+                printf("Unknown quirks '%s', -quirks list shows them\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-quirkdb") == 0 && i + 1 < argc) quirk_db = argv[++i];
+        else if(strcmp(argv[i], "-jobs") == 0 && i + 1 < argc){
+            if(!load_job_file(argv[++i])) return 1;
+        }
+        else if(argv[i][0] == '-'){
+            num_jobs = 0;
+            break;
+        }
+        else add_job(argv[i], seed, NULL);
+    }
+    if(num_jobs == 0 || ipf < 1){
+        printf("Usage: %s [-j threads] [-frames N | -cycles N] [-ipf N] [-seed N] [-nocache] [-noprewarm] [-noidle] [-jit | -jitdiff] [-quirks spec | -quirkdb file] [-checkpoint dir] [-trace dir] [-profile prefix] [-jobs file] [rom | state ...]\n", argv[0]);
+        return 1;
+    }
+    if(quirk_db && chip8_quirks_lookup(quirk_db, 0) == -2){
+        printf("Error: could not read quirk database '%s'\n", quirk_db);
+        return 1;
+    }
+    if(profile_prefix){
+        chip8_t probe = {0};
+        if(!chip8_profile_enable(&probe)){
+            printf("-profile needs a build with profiling compiled in (make batch PROFILE=1)\n");
+            return 1;
+        }
+        chip8_profile_disable(&probe);
+    }
+    if(threads < 1) threads = 1;
+    if(threads > num_jobs) threads = num_jobs;
+
+    // hand every worker an equal contiguous slice up front, stealing evens out the rest
+    num_workers = threads;
+    workers = calloc(num_workers, sizeof(worker_t));
+    for(int w = 0; w < num_workers; w++){
+        uint32_t head = (uint64_t)num_jobs * w / num_workers;
+        uint32_t tail = (uint64_t)num_jobs * (w + 1) / num_workers;
+        workers[w].id = w;
+        atomic_init(&workers[w].range, pack_range(head, tail));
+    }
+
+    double start = now_seconds();
+    for(int w = 0; w < num_workers; w++)
+        pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]);
+    for(int w = 0; w < num_workers; w++)
+        pthread_join(workers[w].thread, NULL);
+    double elapsed = now_seconds() - start;
+
+    print_results();
+    uint64_t cycles = 0, idle_cycles = 0;
+    for(int j = 0; j < num_jobs; j++){
+        cycles += jobs[j].cycles;
+        idle_cycles += jobs[j].idle_cycles;
+    }
+    fprintf(stderr, "%d jobs on %d threads in %.3f s, %.1f%% of opcodes skipped in spin loops\n",
+            num_jobs, num_workers, elapsed, cycles ? 100.0 * idle_cycles / cycles : 0.0);
+
+    for(int j = 0; j < num_jobs; j++){
+        free(jobs[j].rom);
+        free(jobs[j].script);
+    }
+    free(jobs);
+    free(workers);
+    return 0;
+}
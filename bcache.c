@@ -0,0 +1,121 @@
+// Pre-decoded basic-block cache with self-modifying code invalidation
+#include <stdlib.h>
+#include <string.h>
+#include "bcache.h"
+#include "jit.h"
+
+int chip8_bcache_enable(chip8_t *c){
+    if(c->bcache)
+        return 1;
+    c->bcache = malloc(sizeof(chip8_bcache_t));
+    if(c->bcache == NULL)
+        return 0;
+    bcache_flush(c);
+    return 1;
+}
+
+void chip8_bcache_disable(chip8_t *c){
+    free(c->bcache);
+    c->bcache = NULL;
+}
+
+void bcache_flush(chip8_t *c){
+    chip8_bcache_t *bc = c->bcache;
+    if(bc == NULL)
+        return;
+    memset(bc->block_at, 0, sizeof(bc->block_at));
+    memset(bc->code_pages, 0, sizeof(bc->code_pages));
+    bc->num_blocks = 0;
+    bc->num_insns = 0;
+    jit_flush(c); // compiled code belongs to the blocks just dropped
+}
+
+static int ends_block(uint8_t op){
+    switch(op){
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0: // PC goes elsewhere
+        case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: case OP_SKP: case OP_SKNP:
+        case OP_LD_K: // PC does not move
+        case OP_EXIT: // halts
+        case OP_LD_I_LONG: // the next word is its operand, not an opcode
+        case OP_BCD: case OP_STORE: case OP_STORE_R: // may overwrite the rest of the block
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+chip8_block_t *bcache_build(chip8_t *c, uint16_t pc){
+    chip8_bcache_t *bc = c->bcache;
+    if(bc->num_blocks == BCACHE_MAX_BLOCKS || bc->num_insns + BLOCK_MAX_INSNS > BCACHE_MAX_INSNS)
+        bcache_flush(c);
+
+    chip8_block_t *b = &bc->blocks[bc->num_blocks];
+    b->start = pc;
+    b->first = bc->num_insns;
+    b->len = 0;
+    b->hits = 0;
+    b->jit_len = 0;
+    b->code = NULL;
+
+    // never let a block run past the end of MEMORY, the wrap is left to the slow path
+    int max_len = (MEM_SIZE - pc) / 2;
+    if(max_len > BLOCK_MAX_INSNS) max_len = BLOCK_MAX_INSNS;
+    if(max_len < 1) max_len = 1;
+
+    int addr = pc;
+    for(;;){
+        chip8_insn_t *in = &bc->insns[b->first + b->len];
+        chip8_decode(c->MEMORY[addr & MEM_MASK] << 8 | c->MEMORY[(addr + 1) & MEM_MASK], in);
+        b->len++;
+        addr += 2;
+        if(ends_block(in->op) || b->len == max_len)
+            break;
+    }
+
+    // the word after the block counts too: skips and F000 NNNN look at it, at 0x0000 past the end
+    int end = pc + 2 * b->len + 1;
+    int first_page = pc >> CODE_PAGE_SHIFT;
+    int last_page = (end < MEM_SIZE ? end : MEM_SIZE - 1) >> CODE_PAGE_SHIFT;
+    for(int p = first_page; p <= last_page; p++)
+        bc->code_pages[p / 64] |= 1ULL << (p % 64);
+    if(end >= MEM_SIZE)
+        bc->code_pages[0] |= 1;
+
+    bc->num_insns += b->len;
+    bc->block_at[pc] = ++bc->num_blocks;
+    return b;
+}
+
+void bcache_invalidate(chip8_t *c, uint16_t addr, int len){
+    chip8_bcache_t *bc = c->bcache;
+    int first_page = (addr & MEM_MASK) >> CODE_PAGE_SHIFT;
+    int last_page = ((addr + len - 1) & MEM_MASK) >> CODE_PAGE_SHIFT;
+    if(last_page < first_page) // write wrapped around the end of MEMORY
+        last_page += CODE_PAGES;
+
+    for(int i = first_page; i <= last_page; i++){
+        int p = i % CODE_PAGES;
+        if(!(bc->code_pages[p / 64] & (1ULL << (p % 64))))
+            continue;
+
+        // drop every block overlapping the page; one may start up to a block length before it
+        int page_start = p << CODE_PAGE_SHIFT;
+        int page_end = page_start + CODE_PAGE_SIZE;
+        int from = page_start - 2 * BLOCK_MAX_INSNS - 1;
+        if(from < 0) from = 0;
+        for(int pc = from; pc < page_end; pc++){
+            uint16_t b = bc->block_at[pc];
+            if(b && pc + 2 * bc->blocks[b - 1].len + 2 > page_start)
+                bc->block_at[pc] = 0; // the storage is reclaimed at the next flush
+        }
+        if(p == 0){
+            // blocks at the very end of MEMORY read their next word from 0x0000
+            for(int pc = MEM_SIZE - 2 * BLOCK_MAX_INSNS - 1; pc < MEM_SIZE; pc++){
+                uint16_t b = bc->block_at[pc];
+                if(b && pc + 2 * bc->blocks[b - 1].len + 2 > MEM_SIZE)
+                    bc->block_at[pc] = 0;
+            }
+        }
+        bc->code_pages[p / 64] &= ~(1ULL << (p % 64));
+    }
+}
@@ -0,0 +1,50 @@
+// Pre-decoded basic-block cache, private to the interpreter core
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+#define BLOCK_MAX_INSNS 32
+#define BCACHE_MAX_BLOCKS 1024
+#define BCACHE_MAX_INSNS 8192 // both pools are flushed together when either runs out
+
+#define CODE_PAGE_SHIFT 6 // 64-byte pages
+#define CODE_PAGE_SIZE (1 << CODE_PAGE_SHIFT)
+#define CODE_PAGES (MEM_SIZE >> CODE_PAGE_SHIFT)
+
+// Straight-line run of opcodes; only the last one may branch, wait for a key, halt or write memory
+typedef struct {
+    uint16_t start; // PC of the first opcode
+    uint16_t len; // opcodes in the block
+    uint32_t first; // index of the first opcode in chip8_bcache_t.insns
+    uint16_t hits; // times entered, drives promotion to the JIT
+    uint16_t jit_len; // opcodes covered by `code`, counted from the start
+    void *code; // native code for the first jit_len opcodes, NULL if not compiled
+} chip8_block_t;
+
+typedef struct chip8_bcache {
+    uint16_t block_at[MEM_SIZE]; // block index + 1 for each start PC, 0 when not decoded
+    uint64_t code_pages[(CODE_PAGES + 63) / 64]; // bit set when a decoded block reads from the page
+    int num_blocks, num_insns;
+    chip8_block_t blocks[BCACHE_MAX_BLOCKS];
+    chip8_insn_t insns[BCACHE_MAX_INSNS];
+} chip8_bcache_t;
+
+chip8_block_t *bcache_build(chip8_t *c, uint16_t pc);
+void bcache_invalidate(chip8_t *c, uint16_t addr, int len);
+void bcache_flush(chip8_t *c);
+
+static inline chip8_block_t *bcache_lookup(chip8_t *c, uint16_t pc){
+    chip8_bcache_t *bc = c->bcache;
+    uint16_t b = bc->block_at[pc & MEM_MASK];
+    return b ? &bc->blocks[b - 1] : bcache_build(c, pc & MEM_MASK);
+}
+
+// called by every opcode that writes MEMORY, so stale decoded code is never run
+static inline void bcache_written(chip8_t *c, uint16_t addr, int len){
+    if(c->bcache)
+        bcache_invalidate(c, addr, len);
+}
+
+#endif
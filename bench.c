@@ -0,0 +1,276 @@
+// Benchmark suite: synthetic ROMs that each stress one part of the interpreter, run headlessly
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "chip8.h"
+#include "quirks.h"
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_SWITCH
+#define DISPATCH_NAME "switch"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_TABLE
+#define DISPATCH_NAME "table"
+#else
+#define DISPATCH_NAME "goto"
+#endif
+
+#define DEFAULT_CYCLES 5000000 // per run
+#define DEFAULT_RUNS 5
+#define CYCLES_PER_TICK 1000 // timers tick once per this many opcodes
+
+// ALU chain, a skip, I arithmetic, a 1-row draw and a call/return, looping forever
+static const uint16_t rom_mixed[] = {
+    0x6000, // 200: LD V0, 0
+    0x6101, // 202: LD V1, 1
+    0x8014, // 204: ADD V0, V1
+    0x8105, // 206: SUB V1, V0
+    0x8203, // 208: XOR V2, V0
+    0x8306, // 20A: SHR V3
+    0x7307, // 20C: ADD V3, 7
+    0x3000, // 20E: SE V0, 0
+    0x8412, // 210: AND V4, V1
+    0xF21E, // 212: ADD I, V2
+    0xA000, // 214: LD I, 0x000 (font digit 0)
+    0xD011, // 216: DRW V0, V1, 1
+    0x221C, // 218: CALL 0x21C
+    0x1204, // 21A: JP 0x204
+    0x8514, // 21C: ADD V5, V1
+    0x00EE, // 21E: RET
+};
+
+// 8XYN chains: every arithmetic and logic opcode, VF written constantly
+static const uint16_t rom_alu[] = {
+    0x6001, // 200: LD V0, 1
+    0x6103, // 202: LD V1, 3
+    0x8014, // 204: ADD V0, V1
+    0x8105, // 206: SUB V1, V0
+    0x8201, // 208: OR V2, V0
+    0x8312, // 20A: AND V3, V1
+    0x8423, // 20C: XOR V4, V2
+    0x8506, // 20E: SHR V5
+    0x860E, // 210: SHL V6
+    0x8747, // 212: SUBN V7, V4
+    0x8874, // 214: ADD V8, V7
+    0x7911, // 216: ADD V9, 0x11
+    0x8A90, // 218: LD VA, V9
+    0x8BA4, // 21A: ADD VB, VA
+    0x8CB5, // 21C: SUB VC, VB
+    0x1204, // 21E: JP 0x204
+};
+
+// Sprite blitting: 5-row font sprites marching across the screen, wrapping at the edges
+static const uint16_t rom_drw[] = {
+    0x6000, // 200: LD V0, 0
+    0x6100, // 202: LD V1, 0
+    0x6200, // 204: LD V2, 0
+    0x630F, // 206: LD V3, 0x0F
+    0xF229, // 208: LD F, V2
+    0xD015, // 20A: DRW V0, V1, 5
+    0x7003, // 20C: ADD V0, 3
+    0x7105, // 20E: ADD V1, 5
+    0xD015, // 210: DRW V0, V1, 5
+    0x7201, // 212: ADD V2, 1
+    0x8232, // 214: AND V2, V3
+    0x1208, // 216: JP 0x208
+};
+
+// FX55/FX65 memory traffic: all 16 registers stored and loaded, outside the code pages
+static const uint16_t rom_mem[] = {
+    0xA400, // 200: LD I, 0x400
+    0xFF55, // 202: LD [I], VF
+    0xFF65, // 204: LD VF, [I]
+    0x7001, // 206: ADD V0, 1
+    0xF733, // 208: LD B, V7
+    0xF765, // 20A: LD V7, [I]
+    0x1200, // 20C: JP 0x200
+};
+
+// Call/return: three nested levels per iteration, block boundaries everywhere
+static const uint16_t rom_call[] = {
+    0x2206, // 200: CALL 0x206
+    0x7001, // 202: ADD V0, 1
+    0x1200, // 204: JP 0x200
+    0x220C, // 206: CALL 0x20C
+    0x7101, // 208: ADD V1, 1
+    0x00EE, // 20A: RET
+    0x2212, // 20C: CALL 0x212
+    0x7201, // 20E: ADD V2, 1
+    0x00EE, // 210: RET
+    0x7301, // 212: ADD V3, 1
+    0x00EE, // 214: RET
+};
+
+// Busy-wait on the delay timer, the way most games pace themselves
+static const uint16_t rom_dtspin[] = {
+    0x6002, // 200: LD V0, 2
+    0xF015, // 202: LD DT, V0
+    0xF107, // 204: LD V1, DT
+    0x3100, // 206: SE V1, 0
+    0x1204, // 208: JP 0x204
+    0x7201, // 20A: ADD V2, 1
+    0x1202, // 20C: JP 0x202
+};
+
+typedef struct {
+    const char *name;
+    const uint16_t *code;
+    size_t words;
+    uint8_t *data; // big-endian ROM image, built at startup or read from a file
+    size_t size;
+} bench_rom_t;
+
+#define ROM(name, code) { name, code, sizeof(code) / 2, NULL, 0 }
+static bench_rom_t corpus[] = {
+    ROM("alu", rom_alu),
+    ROM("drw", rom_drw),
+    ROM("mem", rom_mem),
+    ROM("call", rom_call),
+    ROM("dtspin", rom_dtspin),
+    ROM("mixed", rom_mixed),
+};
+#undef ROM
+
+static int quirks = CHIP8_QUIRKS_MODERN; // -quirks, a named profile or the generic interpreter
+
+enum { PLAIN, BLOCKS, JIT };
+static const char *engine_names[] = { "plain", "blocks", "jit" };
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One timed run from power-on, returns seconds or -1 when the engine is not available
+static double run(const bench_rom_t *rom, long cycles, int engine, uint64_t *screen){
+    static chip8_t m;
+    init_machine(&m);
+    chip8_seed(&m, 1);
+    chip8_set_quirks(&m, quirks);
+    chip8_jit_disable(&m);
+    chip8_bcache_disable(&m);
+    if(engine == BLOCKS) chip8_bcache_enable(&m);
+    if(engine == JIT && !chip8_jit_enable(&m)) return -1; // no JIT for this host
+    load_rom_data(&m, rom->data, rom->size);
+
+    double start = now_seconds();
+    while(m.cycles < (uint64_t)cycles && !m.halted){
+        chip8_run(&m, CYCLES_PER_TICK);
+        chip8_tick_timers(&m);
+    }
+    double elapsed = now_seconds() - start;
+    *screen = chip8_screen_hash(&m);
+    return elapsed;
+}
+
+static void bench(const bench_rom_t *rom, long cycles, int runs, int engine, int json){
+    double mips[runs];
+    double sum = 0, min = INFINITY, max = 0;
+    uint64_t screen = 0;
+    for(int r = 0; r < runs; r++){
+        double seconds = run(rom, cycles, engine, &screen);
+        if(seconds < 0)
+            return;
+        mips[r] = cycles / seconds / 1e6;
+        sum += mips[r];
+        if(mips[r] < min) min = mips[r];
+        if(mips[r] > max) max = mips[r];
+    }
+    double mean = sum / runs, var = 0;
+    for(int r = 0; r < runs; r++)
+        var += (mips[r] - mean) * (mips[r] - mean);
+    double stddev = runs > 1 ? sqrt(var / (runs - 1)) : 0;
+
+    if(json)
+        printf("{\"dispatch\":\"%s\",\"engine\":\"%s\",\"rom\":\"%s\",\"cycles\":%ld,\"runs\":%d,"
+               "\"mips\":%.2f,\"mips_stddev\":%.2f,\"mips_min\":%.2f,\"mips_max\":%.2f,\"ns_per_insn\":%.3f,\"screen\":\"%016llx\"}\n",
+               DISPATCH_NAME, engine_names[engine], rom->name, cycles, runs,
+               mean, stddev, min, max, 1e3 / mean, (unsigned long long)screen);
+    else
+        printf("%s\t%s\t%s\t%ld\t%d\t%.2f\t%.2f\t%.2f\t%.2f\t%.3f\t%016llx\n",
+               DISPATCH_NAME, engine_names[engine], rom->name, cycles, runs,
+               mean, stddev, min, max, 1e3 / mean, (unsigned long long)screen);
+    fflush(stdout);
+}
+
+static uint8_t *read_file(const char *path, size_t *size){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL)
+        return NULL;
+    uint8_t *data = malloc(MEM_SIZE);
+    *size = fread(data, 1, MEM_SIZE - 0x200, f);
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char* argv[]){
+    long cycles = DEFAULT_CYCLES;
+    int runs = DEFAULT_RUNS, json = 0, header = 1;
+    const char *only = NULL;
+    bench_rom_t files[64];
+    int num_files = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-cycles") == 0 && i + 1 < argc) cycles = atol(argv[++i]);
+        else if(strcmp(argv[i], "-runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-rom") == 0 && i + 1 < argc) only = argv[++i];
+        else if(strcmp(argv[i], "-json") == 0) json = 1;
+        else if(strcmp(argv[i], "-noheader") == 0) header = 0;
+        else if(strcmp(argv[i], "-quirks") == 0 && i + 1 < argc){
+            if((quirks = chip8_quirks_parse(argv[++i])) < 0){
+                printf("Unknown quirks '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(argv[i][0] != '-' && num_files < 64){
+            // ROM files from disk are benchmarked instead of the built-in corpus
+            bench_rom_t *f = &files[num_files];
+            f->name = argv[i];
+            if((f->data = read_file(argv[i], &f->size)) == NULL){
+                fprintf(stderr, "Error: could not read ROM file '%s'\n", argv[i]);
+                return 1;
+            }
+            num_files++;
+        }
+        else {
+            printf("Usage: %s [-cycles n] [-runs n] [-rom name] [-quirks spec] [-json] [-noheader] [rom file ...]\n", argv[0]);
+            printf("Built-in ROMs:");
+            for(size_t r = 0; r < sizeof(corpus) / sizeof(corpus[0]); r++)
+                printf(" %s", corpus[r].name);
+            printf("\n");
+            return 1;
+        }
+    }
+    if(cycles < 1 || runs < 1){
+        printf("-cycles and -runs must be positive\n");
+        return 1;
+    }
+
+    bench_rom_t *roms = num_files ? files : corpus;
+    int num_roms = num_files ? num_files : (int)(sizeof(corpus) / sizeof(corpus[0]));
+    if(!num_files){
+        for(int r = 0; r < num_roms; r++){
+            corpus[r].size = corpus[r].words * 2;
+            corpus[r].data = malloc(corpus[r].size);
+            for(size_t i = 0; i < corpus[r].words; i++){
+                corpus[r].data[2 * i] = corpus[r].code[i] >> 8;
+                corpus[r].data[2 * i + 1] = corpus[r].code[i] & 0xff;
+            }
+        }
+    }
+
+    if(header && !json)
+        printf("# dispatch\tengine\trom\tcycles\truns\tmips\tmips_stddev\tmips_min\tmips_max\tns_per_insn\tscreen_hash\n");
+    for(int r = 0; r < num_roms; r++){
+        if(only && strcmp(only, roms[r].name) != 0)
+            continue;
+        for(int engine = PLAIN; engine <= JIT; engine++)
+            bench(&roms[r], cycles, runs, engine, json);
+    }
+
+    for(int r = 0; r < num_roms; r++)
+        free(roms[r].data);
+    return 0;
+}
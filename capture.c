@@ -0,0 +1,294 @@
+// Frame capture: the emulation thread fills a single-producer single-consumer ring, an encoder thread empties it
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "capture.h"
+
+#define Y4M_WIDTH SCRN_HIRES_WIDTH // the size of the stream can not change, low-res is doubled to it
+#define Y4M_HEIGHT SCRN_HIRES_HEIGHT
+#define PNG_PATTERN_MAX 1024
+#define STORED_BLOCK_MAX 65535 // deflate's limit for one stored block
+
+static const uint8_t gray[4] = { 0x00, 0xFF, 0xAA, 0x55 }; // chip8_planes_to_argb()'s palette
+
+// A frame as queued: SCREEN still packed, 1 bit per pixel and plane
+typedef struct {
+    uint64_t SCREEN[SCRN_PLANES][SCRN_HIRES_HEIGHT][2];
+    uint32_t frame; // emulated frame it was first shown in
+    uint8_t hires;
+} captured_t;
+
+struct capture {
+    captured_t ring[CAPTURE_RING_FRAMES];
+    // producer and consumer indices on their own cache lines, they only ever grow
+    _Alignas(64) _Atomic uint64_t head; // next frame the emulation thread queues
+    captured_t last; // producer-only, what it queued last
+    int queued_any;
+    uint64_t queued, unchanged, dropped;
+    _Alignas(64) _Atomic uint64_t tail; // next frame the encoder writes
+    _Alignas(64) _Atomic int stop;
+    uint32_t end_frame; // set before `stop`
+    // encoder-only
+    FILE *y4m; // NULL for a PNG sequence
+    char pattern[PNG_PATTERN_MAX];
+    captured_t pending; // Y4M: written once the next frame says for how long it was shown
+    int have_pending;
+    uint64_t frames_written, files_written, bytes_written;
+    int failed;
+    const char *path;
+    pthread_t thread;
+};
+
+// Pixel (x, y) as a palette index, in the frame's own resolution
+static int pixel(const captured_t *f, int x, int y){
+    uint64_t bit = 1ULL << (63 - (x & 63));
+    return ((f->SCREEN[0][y][x >> 6] & bit) != 0) | ((f->SCREEN[1][y][x >> 6] & bit) != 0) << 1;
+}
+
+static void write_y4m(capture_t *cap, const captured_t *f, uint32_t times){
+    static uint8_t image[Y4M_WIDTH * Y4M_HEIGHT]; // encoder thread only
+    int scale = f->hires ? 1 : 2;
+    for(int y = 0; y < Y4M_HEIGHT; y++)
+        for(int x = 0; x < Y4M_WIDTH; x++)
+            image[y * Y4M_WIDTH + x] = gray[pixel(f, x / scale, y / scale)];
+    for(uint32_t i = 0; i < times && !cap->failed; i++){
+        if(fputs("FRAME\n", cap->y4m) == EOF || fwrite(image, sizeof(image), 1, cap->y4m) != 1){
+            printf("Error: could not write capture '%s', the rest is discarded\n", cap->path);
+            cap->failed = 1; // keep draining so the emulator never sees a full ring for good
+        }
+        cap->frames_written++;
+        cap->bytes_written += 6 + sizeof(image);
+    }
+}
+
+static uint32_t crc_table[256];
+
+static void make_crc_table(void){
+    for(uint32_t n = 0; n < 256; n++){
+        uint32_t c = n;
+        for(int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *p, size_t len){
+    uint32_t c = 0xFFFFFFFF;
+    for(size_t i = 0; i < len; i++)
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFF;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v){
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+// length, type, data and CRC of one chunk at `p`; `data` may already be in place at p + 8
+static uint8_t *put_chunk(uint8_t *p, const char *type, const uint8_t *data, uint32_t len){
+    put32(p, len);
+    memcpy(p + 4, type, 4);
+    memmove(p + 8, data, len);
+    return put32(p + 8 + len, crc32(p + 4, len + 4));
+}
+
+static void write_png(capture_t *cap, const captured_t *f){
+    int width = f->hires ? SCRN_HIRES_WIDTH : SCRN_WIDTH, height = f->hires ? SCRN_HIRES_HEIGHT : SCRN_HEIGHT;
+    int depth = 1;
+    for(int y = 0; y < height && depth == 1; y++)
+        if(f->SCREEN[1][y][0] | f->SCREEN[1][y][1])
+            depth = 2;
+
+    // scanlines: filter type 0, then the pixels; 1-bit gray is the first plane as it is, 2-bit
+    // gray levels run black, dark, light, white where the palette runs black, white, light, dark
+    static uint8_t raw[SCRN_HIRES_HEIGHT * (1 + SCRN_HIRES_WIDTH / 4)];
+    int stride = 1 + width * depth / 8;
+    for(int y = 0; y < height; y++){
+        uint8_t *row = &raw[y * stride];
+        row[0] = 0;
+        for(int i = 1; i < stride; i++)
+            row[i] = 0;
+        for(int x = 0; x < width; x++){
+            int index = pixel(f, x, y);
+            int level = depth == 1 ? index : (4 - index) & 3;
+            row[1 + x * depth / 8] |= level << (8 - depth - (x * depth) % 8);
+        }
+    }
+    int raw_len = stride * height;
+
+    // zlib stream of stored blocks (one here, the image is at most 2112 bytes), then Adler-32
+    static uint8_t png[128 + sizeof(raw)];
+    uint8_t *p = png;
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+    uint8_t ihdr[13];
+    put32(put32(ihdr, width), height);
+    ihdr[8] = depth;
+    ihdr[9] = 0; // grayscale
+    ihdr[10] = ihdr[11] = ihdr[12] = 0; // deflate, adaptive filtering, no interlace
+    p = put_chunk(p, "IHDR", ihdr, sizeof(ihdr));
+    uint8_t *idat = p + 8;
+    uint8_t *z = idat;
+    *z++ = 0x78; // deflate, 32K window
+    *z++ = 0x01; // no preset dictionary, fastest; 0x7801 is a multiple of 31
+    _Static_assert(sizeof(raw) <= STORED_BLOCK_MAX, "a frame fits one stored block");
+    *z++ = 1; // BFINAL, BTYPE 00
+    *z++ = raw_len & 0xFF;
+    *z++ = raw_len >> 8;
+    *z++ = ~raw_len & 0xFF;
+    *z++ = (~raw_len >> 8) & 0xFF;
+    memcpy(z, raw, raw_len);
+    z += raw_len;
+    uint32_t a = 1, b = 0;
+    for(int i = 0; i < raw_len; i++){
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    z = put32(z, b << 16 | a);
+    p = put_chunk(p, "IDAT", idat, z - idat);
+    p = put_chunk(p, "IEND", NULL, 0);
+
+    char name[PNG_PATTERN_MAX + 16];
+    snprintf(name, sizeof(name), cap->pattern, f->frame);
+    FILE *out = fopen(name, "wb");
+    if(out == NULL || fwrite(png, p - png, 1, out) != 1){
+        printf("Error: could not write capture '%s', the rest is discarded\n", name);
+        cap->failed = 1;
+    }
+    if(out)
+        fclose(out);
+    cap->files_written++;
+    cap->frames_written++;
+    cap->bytes_written += p - png;
+}
+
+// Y4M: the pending frame was shown until `frame`, write it that many times and hold `next` back instead
+static void encode(capture_t *cap, const captured_t *next){
+    if(cap->failed)
+        return;
+    if(cap->y4m == NULL){
+        write_png(cap, next);
+        return;
+    }
+    if(cap->have_pending)
+        write_y4m(cap, &cap->pending, next->frame > cap->pending.frame ? next->frame - cap->pending.frame : 1);
+    cap->pending = *next;
+    cap->have_pending = 1;
+}
+
+static void *encoder_main(void *arg){
+    capture_t *cap = arg;
+    uint64_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+    for(;;){
+        int stopping = atomic_load_explicit(&cap->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&cap->head, memory_order_acquire);
+        if(head == tail){
+            if(stopping)
+                break;
+            // a changed frame at most every 1/60 s, no need to look more often
+            struct timespec ts = { 0, 4000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        encode(cap, &cap->ring[tail % CAPTURE_RING_FRAMES]);
+        atomic_store_explicit(&cap->tail, ++tail, memory_order_release);
+    }
+    if(cap->have_pending && !cap->failed)
+        write_y4m(cap, &cap->pending, cap->end_frame > cap->pending.frame ? cap->end_frame - cap->pending.frame : 1);
+    return NULL;
+}
+
+// `path` with one %u and no other conversion, or .png with _%06u put before it
+static int make_pattern(char *pattern, const char *path){
+    const char *percent = strchr(path, '%');
+    if(percent == NULL){
+        size_t len = strlen(path) - 4; // without .png
+        if(len + 16 > PNG_PATTERN_MAX)
+            return 0;
+        snprintf(pattern, PNG_PATTERN_MAX, "%.*s_%%06u.png", (int)len, path);
+        return 1;
+    }
+    const char *spec = percent + 1;
+    spec += strspn(spec, "0123456789");
+    if(*spec != 'u' || strchr(spec, '%') || strlen(path) >= PNG_PATTERN_MAX)
+        return 0;
+    strcpy(pattern, path);
+    return 1;
+}
+
+capture_t *capture_open(const char *path){
+    size_t len = strlen(path);
+    int y4m = len > 4 && strcmp(path + len - 4, ".y4m") == 0;
+    if(!y4m && !(len > 4 && strcmp(path + len - 4, ".png") == 0)){
+        printf("Error: capture '%s' is neither a .y4m stream nor a .png pattern\n", path);
+        return NULL;
+    }
+    capture_t *cap = calloc(1, sizeof(capture_t));
+    if(cap == NULL)
+        return NULL;
+    cap->path = path;
+    if(y4m){
+        if((cap->y4m = fopen(path, "wb")) == NULL){
+            printf("Error: could not create capture '%s'\n", path);
+            free(cap);
+            return NULL;
+        }
+        int header = fprintf(cap->y4m, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", Y4M_WIDTH, Y4M_HEIGHT);
+        cap->bytes_written = header > 0 ? header : 0;
+    } else if(!make_pattern(cap->pattern, path)){
+        printf("Error: capture '%s' may hold one %%u for the frame number and no other %%\n", path);
+        free(cap);
+        return NULL;
+    }
+    make_crc_table();
+    if(pthread_create(&cap->thread, NULL, encoder_main, cap) != 0){
+        printf("Error: could not start capture '%s'\n", path);
+        if(cap->y4m)
+            fclose(cap->y4m);
+        free(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+void capture_frame(capture_t *cap, const frame_t *f){
+    // the display often stays the same between DRWs (a sprite drawn and erased again)
+    if(cap->queued_any && f->hires == cap->last.hires && memcmp(f->SCREEN, cap->last.SCREEN, sizeof(f->SCREEN)) == 0){
+        cap->unchanged++;
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&cap->tail, memory_order_acquire) == CAPTURE_RING_FRAMES){
+        cap->dropped++; // the previous frame is shown for longer instead
+        return;
+    }
+    captured_t *slot = &cap->ring[head % CAPTURE_RING_FRAMES];
+    memcpy(slot->SCREEN, f->SCREEN, sizeof(slot->SCREEN));
+    slot->hires = f->hires;
+    slot->frame = f->frame;
+    cap->last = *slot;
+    cap->queued_any = 1;
+    cap->queued++;
+    atomic_store_explicit(&cap->head, head + 1, memory_order_release);
+}
+
+void capture_close(capture_t *cap, uint32_t end_frame, FILE *stats){
+    if(cap == NULL)
+        return;
+    cap->end_frame = end_frame;
+    atomic_store_explicit(&cap->stop, 1, memory_order_release);
+    pthread_join(cap->thread, NULL);
+    if(cap->y4m && fclose(cap->y4m) != 0 && !cap->failed)
+        printf("Error: could not write capture '%s'\n", cap->path);
+    if(stats)
+        fprintf(stats, "capture: %llu frames queued, %llu unchanged skipped, %llu dropped, %llu frames in %llu bytes%s\n",
+                (unsigned long long)cap->queued, (unsigned long long)cap->unchanged, (unsigned long long)cap->dropped,
+                (unsigned long long)cap->frames_written, (unsigned long long)cap->bytes_written,
+                cap->y4m ? "" : " of PNG");
+    free(cap);
+}
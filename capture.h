@@ -0,0 +1,33 @@
+// Frame capture: published frames through a ring to an encoder thread, out as a Y4M stream or PNG files
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "handoff.h"
+
+#define CAPTURE_RING_FRAMES 512 // ~1 MB, changed frames the encoder may fall behind by
+
+/* Frames are timed by their emulated frame number and only queued when the
+   display changed, still at 1 bit per pixel and plane. The two outputs:
+   - "<name>.y4m": uncompressed 128x64 grayscale (Cmono) at 60 fps, low-res
+     frames pixel-doubled. Unchanged frames are written again, so the stream
+     plays at the emulated speed.
+   - "<pattern>.png": one PNG per changed frame, numbered by its emulated
+     frame; a gap in the numbers is a frame shown for longer. The pattern
+     holds one %u (e.g. shot%05u.png), or _%06u is put before the .png.
+     1-bit grayscale while only the first plane is used, 2-bit with XO-CHIP
+     colours, deflate's stored blocks instead of compression.
+   The emulator never waits: with the ring full a frame is dropped and the
+   one before it stays on longer. */
+typedef struct capture capture_t;
+
+// Start capturing to `path`, NULL after printing why on failure
+capture_t *capture_open(const char *path);
+// Emulation thread: queue `f` if it differs from the frame queued last
+void capture_frame(capture_t *cap, const frame_t *f);
+/* Drain the ring, stop the encoder and free `cap`; a Y4M stream gets its
+   last frame until `end_frame`. Prints what was written to `stats` unless NULL. */
+void capture_close(capture_t *cap, uint32_t end_frame, FILE *stats);
+
+#endif
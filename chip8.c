@@ -0,0 +1,1011 @@
+// CHIP-8 interpreter core
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "chip8.h"
+#include "bcache.h"
+#include "jit.h"
+#include "profile.h"
+
+const uint8_t fontset[80] = {
+  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+  0x20, 0x60, 0x20, 0x20, 0x70, // 1
+  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+const uint8_t bigfontset[160] = {
+  0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+  0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+  0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+  0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+  0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+  0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+  0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+  0x3C, 0x7E, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, // A
+  0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+  0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF, // E
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// every opcode that writes MEMORY goes through here, `len` is at most a page
+static inline void memory_written(chip8_t *c, uint16_t addr, int len){
+    unsigned first = (addr & MEM_MASK) >> CHIP8_PAGE_SHIFT, last = ((addr + len - 1) & MEM_MASK) >> CHIP8_PAGE_SHIFT;
+    c->written_pages[first / 64] |= 1ULL << (first % 64);
+    c->written_pages[last / 64] |= 1ULL << (last % 64);
+    c->rewind_pages[first / 64] |= 1ULL << (first % 64);
+    c->rewind_pages[last / 64] |= 1ULL << (last % 64);
+    bcache_written(c, addr, len); // stale decoded code is never run
+}
+
+// all of MEMORY was replaced
+static void memory_replaced(chip8_t *c){
+    memset(c->written_pages, 0xff, sizeof(c->written_pages));
+    memset(c->rewind_pages, 0xff, sizeof(c->rewind_pages));
+    bcache_flush(c);
+}
+
+int load_rom(chip8_t *c, const char* filename){
+    // load the rom from real file into MEMORY
+    FILE *rom_file = fopen(filename, "rb");
+    if(rom_file == NULL){
+        printf("Error: could not open ROM file '%s'\n", filename);
+        return 0;
+    }
+
+    /*here we get file size*/
+    fseek(rom_file, 0, SEEK_END);
+    long rom_size = ftell(rom_file);
+    rewind(rom_file); // go to beggining
+
+    /*check if rom is suitable for memory*/
+    if(rom_size > (MEM_SIZE - 0x200)){
+        printf("Error: ROM file '%s' is too large for memory. Size: %ld bytes\n", filename, rom_size);
+        fclose(rom_file);
+        return 0;
+    }
+    
+    /*read rom into memory*/
+    memory_replaced(c);
+    size_t bytes_read = fread(&c->MEMORY[0x200], 1, rom_size, rom_file);
+    if(bytes_read != rom_size){
+        printf("Warning: Mismatch in bytes read for ROM '%s'. Expected %ld, got %zu\n", filename, rom_size, bytes_read);
+    }
+
+    fclose(rom_file);
+    printf("Successfully loaded ROM '%s' (%ld bytes)\n", filename, rom_size);
+    return 1; 
+
+}
+
+
+static void build_op_table(void);
+static uint8_t op_table[16][256];
+static pthread_once_t op_table_once = PTHREAD_ONCE_INIT;
+
+void init_machine(chip8_t *c)
+{
+    pthread_once(&op_table_once, build_op_table); // shared by every machine in the process
+
+    /*Init all variables and memory*/
+    c->PC = 0x200;
+    c->SP = 0;
+    c->I = 0;
+    c->DT = 0;
+    c->ST = 0;
+    c->waiting_for_key = 0;
+    c->key_dest = 0;
+    c->draw_screen_flag = 0;
+    c->key_press_buffer = -1;
+    c->hires = 0;
+    c->planes = 1;
+    c->exited = 0;
+    c->extensions = 0;
+    c->PITCH = 64; // 4000 Hz
+    memset(c->FLAGS, 0, sizeof(c->FLAGS));
+    memset(c->AUDIO_PATTERN, 0, sizeof(c->AUDIO_PATTERN));
+
+    for(int i = 0; i < 80; i++) c->MEMORY[i] = fontset[i]; // load fonts into memory
+    for(int i = 0; i < 160; i++) c->MEMORY[BIGFONT_ADDR + i] = bigfontset[i];
+    for(int i = BIGFONT_ADDR + 160; i < MEM_SIZE; i++) c->MEMORY[i] = 0;
+    for(int i = 0; i < 16; i++) {
+        // initialize V and keyboard in one loop because they have same size
+        c->V[i] = 0;
+        c->KEYBOARD[i] = 0;
+    }
+    memset(c->SCREEN, 0, sizeof(c->SCREEN)); //black screen
+    for(int i = 0; i < STCK_SIZE; i++) c->STACK[i] = 0;
+
+    c->halted = 0;
+    c->cycles = 0;
+    memory_replaced(c);
+
+    chip8_seed(c, (uint32_t)time(NULL));
+}
+
+void chip8_restore(chip8_t *c, const void *state){
+    pthread_once(&op_table_once, build_op_table); // `c` may never have been through init_machine
+    memcpy(c, state, CHIP8_STATE_SIZE);
+    c->draw_screen_flag = 1; // whatever is on the host's screen belongs to another state
+    memory_replaced(c); // blocks were decoded from the old MEMORY
+}
+
+void chip8_seed(chip8_t *c, uint32_t seed){
+    // xorshift32 must never hold 0, it would stay 0 forever
+    c->rng = seed ? seed : 0x2545F491;
+}
+
+void error_out_of_stack(chip8_t *c){
+    printf("SP is out of stack! PC=%03x SP=%d I=%03x\n", c->PC, c->SP, c->I);
+    // the whole machine goes to a save state, which can be loaded back to inspect or resume it
+    if(chip8_save_state(c, "out_of_stack.c8s"))
+        printf("Machine state exported to out_of_stack.c8s\n");
+    exit(1); // Terminate the program after dumping
+}
+
+void chip8_key_down(chip8_t *c, uint8_t key){
+    c->KEYBOARD[key] = 1;
+
+    // If we are waiting for a key (due to FX0A)
+    // AND the key_press_buffer is currently empty (-1 means no key recorded yet)
+    // THEN record this new key press.
+    if (c->waiting_for_key && c->key_press_buffer == -1) {
+        c->key_press_buffer = key;
+    }
+}
+
+void chip8_key_up(chip8_t *c, uint8_t key){
+    c->KEYBOARD[key] = 0;
+
+    // If the key that was just released is the one currently stored
+    // in the key_press_buffer, then clear the buffer.
+    // This ensures that the *next* FX0A will wait for a new press.
+    if (c->key_press_buffer == key) {
+        c->key_press_buffer = -1;
+    }
+}
+
+int load_rom_data(chip8_t *c, const uint8_t *data, long size){
+    // same as load_rom, for hosts that already hold the ROM image
+    if(size > (MEM_SIZE - 0x200)){
+        return 0;
+    }
+    for(long i = 0; i < size; i++) c->MEMORY[0x200 + i] = data[i];
+    memory_replaced(c);
+    return 1;
+}
+
+uint64_t chip8_screen_hash(const chip8_t *c){
+    // FNV-1a over the framebuffer rows, cheap enough to compare frames
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < SCRN_HEIGHT; i++){
+        hash ^= c->SCREEN[0][i][0];
+        hash *= 0x100000001b3ULL;
+    }
+    // the words a classic ROM never touches only count when set, so its hashes stay the same
+    const uint64_t *words = &c->SCREEN[0][0][0];
+    for(int i = 0; i < SCRN_PLANES * SCRN_HIRES_HEIGHT * 2; i++){
+        if(words[i] == 0 || (i < SCRN_HEIGHT * 2 && (i & 1) == 0))
+            continue;
+        hash ^= words[i];
+        hash *= 0x100000001b3ULL;
+        hash ^= i;
+        hash *= 0x100000001b3ULL;
+    }
+    if(c->hires){
+        hash ^= 1;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int chip8_screen_width(const chip8_t *c){
+    return c->hires ? SCRN_HIRES_WIDTH : SCRN_WIDTH;
+}
+
+int chip8_screen_height(const chip8_t *c){
+    return c->hires ? SCRN_HIRES_HEIGHT : SCRN_HEIGHT;
+}
+
+#define PIXEL_ON 0xFFFFFFFF // White, opaque alpha
+#define PIXEL_OFF 0xFF000000 // Black, opaque alpha
+
+// colors by plane bits: off, plane 0 only, plane 1 only, both
+static const uint32_t palette[4] = { PIXEL_OFF, PIXEL_ON, 0xFFAAAAAA, 0xFF555555 };
+
+// 64 pixels of a single-plane word
+static void expand_word(uint64_t row, uint32_t *out){
+#if defined(__AVX2__)
+    // 8 pixels per step: broadcast the sprite byte, test one bit per lane, pick on/off
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i on = _mm256_set1_epi32(PIXEL_ON), off = _mm256_set1_epi32(PIXEL_OFF);
+    for(int x = 0; x < 64; x += 8){
+        __m256i b = _mm256_set1_epi32((row >> (56 - x)) & 0xff);
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(b, bits), bits);
+        _mm256_storeu_si256((__m256i *)&out[x], _mm256_blendv_epi8(off, on, mask));
+    }
+#elif defined(__SSE2__)
+    // 4 pixels per step, same idea with SSE2 and and/andnot/or as the blend
+    const __m128i bits = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+    const __m128i on = _mm_set1_epi32(PIXEL_ON), off = _mm_set1_epi32(PIXEL_OFF);
+    for(int x = 0; x < 64; x += 4){
+        __m128i b = _mm_set1_epi32((row >> (60 - x)) & 0xf);
+        __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(b, bits), bits);
+        _mm_storeu_si128((__m128i *)&out[x], _mm_or_si128(_mm_and_si128(mask, on), _mm_andnot_si128(mask, off)));
+    }
+#else
+    for(int x = 0; x < 64; x++)
+        out[x] = (row >> (63 - x)) & 1 ? PIXEL_ON : PIXEL_OFF;
+#endif
+}
+
+void chip8_screen_to_argb(const chip8_t *c, uint32_t *pixels, int pitch, int first_row, int num_rows){
+    chip8_planes_to_argb(c->SCREEN, c->hires, pixels, pitch, first_row, num_rows);
+}
+
+void chip8_planes_to_argb(const uint64_t screen[SCRN_PLANES][SCRN_HIRES_HEIGHT][2], int hires,
+                          uint32_t *pixels, int pitch, int first_row, int num_rows){
+    int words = hires ? 2 : 1;
+    for(int y = first_row; y < first_row + num_rows; y++){
+        uint32_t *out = (uint32_t *)((uint8_t *)pixels + (y - first_row) * pitch);
+        for(int w = 0; w < words; w++, out += 64){
+            uint64_t p0 = screen[0][y][w], p1 = screen[1][y][w];
+            if(p1 == 0){
+                expand_word(p0, out); // everything but XO-CHIP color
+                continue;
+            }
+            for(int x = 0; x < 64; x++)
+                out[x] = palette[((p0 >> (63 - x)) & 1) | ((p1 >> (63 - x)) & 1) << 1];
+        }
+    }
+}
+
+void chip8_tick_timers(chip8_t *c){
+    // called at 60 Hz by the host
+    if (c->DT > 0) c->DT--;
+    if (c->ST > 0) c->ST--;
+}
+
+
+void inst_cls(chip8_t *c){
+    // CLS - clear the display (the selected XO-CHIP planes)
+    for(int p = 0; p < SCRN_PLANES; p++)
+        if(c->planes & (1 << p))
+            memset(c->SCREEN[p], 0, sizeof(c->SCREEN[p])); // black screen
+    c->draw_screen_flag = 1; // clear the screen immidietly
+    c->PC += 2;
+}
+
+void inst_ret(chip8_t *c){
+    // RET - return from a subroutine
+    if(c->SP == 0){
+        // nothing to return to, leave the state for the host to report
+        c->halted = 1;
+        return;
+    }
+    c->PC = c->STACK[c->SP]; // set the address for the top of the stack
+    c->SP--; // substract 1 from stack pointer
+    c->PC += 2;
+    PROFILE_RET(c);
+}
+
+void inst_jp(chip8_t *c, uint16_t address){
+    // JP addr - jump to a location address
+    c->PC = address;
+}
+
+void inst_call(chip8_t *c, uint16_t address){
+    // CALL addr - call a subroutine at addr
+    if(c->SP + 1 > STCK_SIZE - 1){
+        c->halted = 1; // the host decides whether to dump (error_out_of_stack) or drop the machine
+        return; // SP stays in range, the machine may still be saved
+    }
+    c->SP += 1;
+    c->STACK[c->SP] = c->PC;
+    c->PC = address;
+    PROFILE_CALL(c, address);
+}
+
+static inline void skip_next(chip8_t *c){
+    // step over the next opcode, which is 4 bytes long when it is F000 NNNN
+    int long_op = c->MEMORY[(c->PC + 2) & MEM_MASK] == 0xf0 && c->MEMORY[(c->PC + 3) & MEM_MASK] == 0x00;
+    c->PC += long_op ? 6 : 4;
+}
+
+void inst_se(chip8_t *c, uint8_t x, uint8_t kk){
+    // SE Vx, byte - skip next instruction if Vx = kk
+    if(c->V[x] == kk) skip_next(c);
+    else{
+        c->PC += 2;
+    }
+}
+
+void inst_sne(chip8_t *c, uint8_t x, uint8_t kk){
+    // SNE Vx, byte - skip next instruction if Vx != kk
+    if(c->V[x] != kk) skip_next(c);
+    else{
+        c->PC += 2;
+    }
+}
+
+void inst_ld(chip8_t *c, uint8_t x, uint8_t kk){
+    // LD Vx, byte - put the value kk into register Vx
+    c->V[x] = kk;
+    c->PC += 2;
+}
+
+void inst_add(chip8_t *c, uint8_t x, uint8_t kk){
+    // ADD Vx, byte - adds the value byte to value of register Vx and stores result in Vx
+    c->V[x] += kk;
+    c->PC += 2;
+}
+
+/* The opcodes whose behaviour depends on a quirk are written once, as
+   always-inlined *_q functions taking the quirk bits. The interpreters in
+   interp.h pass their profile's constant, so the tests fold away there; the
+   public inst_* versions pass c->quirks. */
+#if defined(__GNUC__)
+#define QUIRK_INLINE static inline __attribute__((always_inline))
+#else
+#define QUIRK_INLINE static inline
+#endif
+
+QUIRK_INLINE void inst_or_q(chip8_t *c, uint8_t x, uint8_t y, int quirks){
+    // OR Vx, Vy - bitwise OR on the values Vx and Vy and store result in Vx
+    c->V[x] = c->V[x] | c->V[y];
+    if(quirks & CHIP8_QUIRK_VF_RESET) c->V[0xf] = 0;
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_and_q(chip8_t *c, uint8_t x, uint8_t y, int quirks){
+    // AND Vx, Vy - bitwise AND on the values Vx and Vy and store result in Vx
+    c->V[x] = c->V[x] & c->V[y];
+    if(quirks & CHIP8_QUIRK_VF_RESET) c->V[0xf] = 0;
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_xor_q(chip8_t *c, uint8_t x, uint8_t y, int quirks){
+    // XOR Vx, Vy - bitwise XOR on the values Vx and Vy and store result in Vx
+    c->V[x] = c->V[x] ^ c->V[y];
+    if(quirks & CHIP8_QUIRK_VF_RESET) c->V[0xf] = 0;
+    c->PC += 2;
+}
+
+void inst_or(chip8_t *c, uint8_t x, uint8_t y){ inst_or_q(c, x, y, c->quirks); }
+void inst_and(chip8_t *c, uint8_t x, uint8_t y){ inst_and_q(c, x, y, c->quirks); }
+void inst_xor(chip8_t *c, uint8_t x, uint8_t y){ inst_xor_q(c, x, y, c->quirks); }
+
+void inst_add_vx_vy(chip8_t *c, uint8_t x, uint8_t y){
+    // ADD Vx, Vy - The values of Vx and Vy are added together, if the result is greater that 8 bits then VF is set to 1, otherwise 0
+    uint16_t sum = 0;
+    sum = c->V[x] + c->V[y];
+    c->V[x] = sum & 0x00ff; // only 8 bits are stored in V[x]
+    if((sum & 0xff00) == 0x0000){ // no overflow
+        c->V[0xf] = 0;
+    }
+    else{
+        c->V[0xf] = 1;
+    }
+    c->PC += 2;
+}
+
+void inst_sub_vx_vy(chip8_t *c, uint8_t x, uint8_t y){
+    // SUB Vx, Vy - Vx minus Vy and store in Vx, set VF to 1 if Vx > Vy
+    if(c->V[x] > c->V[y]){
+        c->V[0xf] = 1;
+    }
+    else{
+        c->V[0xf] = 0;
+    }
+    c->V[x] -= c->V[y];
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_shr_q(chip8_t *c, uint8_t x, uint8_t y, int quirks){
+    // SHR Vx {, Vy} - VF = least-significant bit of the source, then Vx = source / 2; the source is Vy with QUIRK_SHIFT_VY
+    uint8_t src = quirks & CHIP8_QUIRK_SHIFT_VY ? y : x;
+    c->V[0xf] = c->V[src] & 0x1;
+    c->V[x] = c->V[src] >> 1;
+    c->PC += 2;
+}
+
+void inst_shr(chip8_t *c, uint8_t x, uint8_t y){ inst_shr_q(c, x, y, c->quirks); }
+
+void inst_subn_vx_vy(chip8_t *c, uint8_t x, uint8_t y){
+    // SUBN Vx, Vy - Vy minus Vx and store in Vx, set VF to 1 if Vy > Vx
+    if(c->V[x] < c->V[y]){
+        c->V[0xf] = 1;
+    }
+    else{
+        c->V[0xf] = 0;
+    }
+    c->V[x] = c->V[y] - c->V[x];
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_shl_q(chip8_t *c, uint8_t x, uint8_t y, int quirks){
+    // SHL Vx {, Vy} - VF = most-significant bit of the source, then Vx = source * 2
+    uint8_t src = quirks & CHIP8_QUIRK_SHIFT_VY ? y : x;
+    c->V[0xf] = (c->V[src] >> 7) & 0x1;
+    c->V[x] = c->V[src] << 1;
+    c->PC += 2;
+}
+
+void inst_shl(chip8_t *c, uint8_t x, uint8_t y){ inst_shl_q(c, x, y, c->quirks); }
+
+void inst_ld_addr(chip8_t *c, uint16_t addr){
+    // LD I, addr - I is set to addr
+    c->I = addr;
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_jp_v0_q(chip8_t *c, uint16_t addr, int quirks){
+    // JP V0, addr - jump to location addr + V0, or to addr + VX with QUIRK_JUMP_VX (X = high nibble of addr)
+    c->PC = addr + c->V[quirks & CHIP8_QUIRK_JUMP_VX ? addr >> 8 : 0x0];
+}
+
+void inst_jp_v0(chip8_t *c, uint16_t addr){ inst_jp_v0_q(c, addr, c->quirks); }
+
+void inst_rnd(chip8_t *c, uint8_t x, uint8_t kk){
+    // RND Vx, byte - Generate random number, AND it with kk and store in Vx
+    // xorshift32 keeps the generator inside the machine instead of libc's shared rand() state
+    uint32_t r = c->rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    c->rng = r;
+    int randomNumber = (r % 256) & kk;
+    c->V[x] = randomNumber;
+    c->PC += 2;
+}
+
+// XOR a sprite row (left-aligned in `sprite`) into a 128-pixel row at column x, wrapping unless `clip`; 1 on collision
+static int xor_row128(uint64_t line[2], uint64_t sprite, int x, int clip){
+    uint64_t w0, w1;
+    if(x < 64){
+        w0 = sprite >> x;
+        w1 = x ? sprite << (64 - x) : 0;
+    } else {
+        w1 = sprite >> (x - 64);
+        w0 = x > 64 && !clip ? sprite << (128 - x) : 0; // past column 127, back to the left
+    }
+    int hit = (line[0] & w0) || (line[1] & w1);
+    line[0] ^= w0;
+    line[1] ^= w1;
+    return hit;
+}
+
+// DRW in hi-res, with 16x16 sprites (DXY0) or more than one plane selected
+static void drw_planes(chip8_t *c, uint8_t x, uint8_t y, uint8_t n, int clip){
+    int width = chip8_screen_width(c), height = chip8_screen_height(c);
+    int vx = c->V[x] % width, vy = c->V[y] % height;
+    int rows = n ? n : 16, wide = n == 0;
+    uint16_t addr = c->I;
+    c->V[0xf] = 0;
+    // each selected plane takes the next sprite in memory
+    for(int p = 0; p < SCRN_PLANES; p++){
+        if(!(c->planes & (1 << p)))
+            continue;
+        for(int row = 0; row < rows; row++){
+            uint64_t sprite = (uint64_t)c->MEMORY[addr & MEM_MASK] << 56;
+            if(wide)
+                sprite |= (uint64_t)c->MEMORY[(addr + 1) & MEM_MASK] << 48;
+            addr += wide ? 2 : 1;
+            if(clip && vy + row >= height)
+                continue; // still step over the rows, the next plane's sprite comes after them
+
+            int line = (vy + row) % height;
+            uint64_t *words = c->SCREEN[p][line];
+            if(c->hires){
+                if(xor_row128(words, sprite, vx, clip))
+                    c->V[0xf] = 1;
+            } else {
+                sprite = clip ? sprite >> vx : (sprite >> vx) | (sprite << ((64 - vx) & 63));
+                if(words[0] & sprite)
+                    c->V[0xf] = 1;
+                words[0] ^= sprite;
+            }
+        }
+    }
+}
+
+QUIRK_INLINE void inst_drw_q(chip8_t *c, uint8_t x, uint8_t y, uint8_t n, int quirks){
+    // DRW Vx, Vy, nibble - display n-byte sprite starting at memory location I at (Vx, Vx), set VF = collision
+    int clip = quirks & CHIP8_QUIRK_CLIP;
+    if(c->hires || n == 0 || c->planes != 1){
+        drw_planes(c, x, y, n, clip);
+        c->draw_screen_flag = 1;
+        c->PC += 2;
+        return;
+    }
+    uint8_t vx = c->V[x] % 64; // width
+    uint8_t vy = c->V[y] % 32; // height
+    c->V[0xf] = 0; // reset the collision flag
+    if(clip && vy + n > 32)
+        n = 32 - vy; // the start position wraps, the sprite itself stops at the bottom edge
+    for(int row = 0; row < n; row++){
+        // sprite byte at the left edge of a row, rotated into place; columns past 63 wrap to the left unless clipped
+        uint64_t sprite = (uint64_t)c->MEMORY[(c->I + row) & MEM_MASK] << 56;
+        sprite = clip ? sprite >> vx : (sprite >> vx) | (sprite << ((64 - vx) & 63));
+
+        uint64_t *line = &c->SCREEN[0][(vy + row) % 32][0];
+        if(*line & sprite){
+            c->V[0xf] = 1; // collision detected
+        }
+        *line ^= sprite;
+    }
+    c->draw_screen_flag = 1;
+    c->PC += 2;
+}
+
+void inst_drw(chip8_t *c, uint8_t x, uint8_t y, uint8_t n){ inst_drw_q(c, x, y, n, c->quirks); }
+
+void inst_skp(chip8_t *c, uint8_t x){
+    // SKP Vx - skip next instruction if key is pressed (key value is stored in Vx)
+    if(c->KEYBOARD[c->V[x] & 0xf]){
+        skip_next(c);
+    }
+    else{
+        c->PC += 2;
+    }
+}
+
+void inst_sknp(chip8_t *c, uint8_t x){
+    // SKNP Vx - skip next instruction if key is not pressed
+    if(!c->KEYBOARD[c->V[x] & 0xf]){
+        skip_next(c);
+    }
+    else{
+        c->PC += 2;
+    }
+}
+
+void inst_ld_dt(chip8_t *c, uint8_t x){
+    // LD Vx, DT - set Vx to delay timer value
+    c->V[x] = c->DT;
+    c->PC += 2;
+}
+
+void inst_ld_k(chip8_t *c, uint8_t x){
+    // LD Vx, K - wait for a key press, store the value of key in Vx
+    c->waiting_for_key = 1;
+    c->key_dest = x;
+    c->key_press_buffer = -1;
+}
+
+void inst_dt_ld(chip8_t *c, uint8_t x){
+    // LD DT, Vx - set display timer to Vx
+    c->DT = c->V[x];
+    c->PC += 2;
+}
+
+void inst_st_ld(chip8_t *c, uint8_t x){
+    // LD ST, Vx - set sound timer to Vx
+    c->ST = c->V[x];
+    c->PC += 2;
+}
+
+void inst_add_i(chip8_t *c, uint8_t x){
+    // ADD I, Vx - set I = I + Vx
+    c->I += c->V[x];
+    c->PC += 2;
+}
+
+void inst_f_ld(chip8_t *c, uint8_t x){
+    // LD F, Vx - set I = location of sprite for digit Vx
+    c->I = c->V[x] * 5; // sprites are 5 bytes long
+    c->PC += 2;
+}
+
+void inst_bcd_ld(chip8_t *c, uint8_t x){
+    // LD B, Vx - store BCD representation of Vx in memory locations I, I+1 and I+2
+    c->MEMORY[c->I & MEM_MASK] = (c->V[x] % 1000 - c->V[x] % 100) / 100;
+    c->MEMORY[(c->I+1) & MEM_MASK] = (c->V[x] % 100 - c->V[x] % 10) / 10;
+    c->MEMORY[(c->I+2) & MEM_MASK] = c->V[x] % 10;
+    memory_written(c, c->I, 3);
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_store_registers_q(chip8_t *c, uint8_t x, int quirks){
+    // LD [I], Vx - copy registers to memory, then I = I + x + 1 with QUIRK_MEM_I
+    for(int i = 0; i < x+1; i++){
+        c->MEMORY[(c->I+i) & MEM_MASK] = c->V[i];
+    }
+    memory_written(c, c->I, x + 1);
+    if(quirks & CHIP8_QUIRK_MEM_I) c->I += x + 1;
+    c->PC += 2;
+}
+
+QUIRK_INLINE void inst_read_registers_q(chip8_t *c, uint8_t x, int quirks){
+    // LD Vx, [I] - read from memory to registers, then I = I + x + 1 with QUIRK_MEM_I
+    for(int i = 0; i < x+1; i++){
+        c->V[i] = c->MEMORY[(c->I+i) & MEM_MASK];
+    }
+    if(quirks & CHIP8_QUIRK_MEM_I) c->I += x + 1;
+    c->PC += 2;
+}
+
+void inst_store_registers(chip8_t *c, uint8_t x){ inst_store_registers_q(c, x, c->quirks); }
+void inst_read_registers(chip8_t *c, uint8_t x){ inst_read_registers_q(c, x, c->quirks); }
+
+static void screen_changed(chip8_t *c){
+    c->draw_screen_flag = 1;
+}
+
+void inst_scroll_down(chip8_t *c, uint8_t n){
+    // SCD nibble - scroll the selected planes down n rows (SUPER-CHIP)
+    int height = chip8_screen_height(c);
+    if(n > height) n = height;
+    for(int p = 0; p < SCRN_PLANES; p++){
+        if(!(c->planes & (1 << p))) continue;
+        memmove(c->SCREEN[p][n], c->SCREEN[p][0], (height - n) * sizeof(c->SCREEN[p][0]));
+        memset(c->SCREEN[p][0], 0, n * sizeof(c->SCREEN[p][0]));
+    }
+    c->extensions |= CHIP8_EXT_SCHIP;
+    screen_changed(c);
+    c->PC += 2;
+}
+
+void inst_scroll_up(chip8_t *c, uint8_t n){
+    // SCU nibble - scroll the selected planes up n rows (XO-CHIP)
+    int height = chip8_screen_height(c);
+    if(n > height) n = height;
+    for(int p = 0; p < SCRN_PLANES; p++){
+        if(!(c->planes & (1 << p))) continue;
+        memmove(c->SCREEN[p][0], c->SCREEN[p][n], (height - n) * sizeof(c->SCREEN[p][0]));
+        memset(c->SCREEN[p][height - n], 0, n * sizeof(c->SCREEN[p][0]));
+    }
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    screen_changed(c);
+    c->PC += 2;
+}
+
+void inst_scroll_right(chip8_t *c){
+    // SCR - scroll the selected planes right 4 pixels, a shift per word
+    int height = chip8_screen_height(c);
+    for(int p = 0; p < SCRN_PLANES; p++){
+        if(!(c->planes & (1 << p))) continue;
+        for(int y = 0; y < height; y++){
+            uint64_t *row = c->SCREEN[p][y];
+            if(c->hires)
+                row[1] = row[1] >> 4 | row[0] << 60;
+            row[0] >>= 4;
+        }
+    }
+    c->extensions |= CHIP8_EXT_SCHIP;
+    screen_changed(c);
+    c->PC += 2;
+}
+
+void inst_scroll_left(chip8_t *c){
+    // SCL - scroll the selected planes left 4 pixels
+    int height = chip8_screen_height(c);
+    for(int p = 0; p < SCRN_PLANES; p++){
+        if(!(c->planes & (1 << p))) continue;
+        for(int y = 0; y < height; y++){
+            uint64_t *row = c->SCREEN[p][y];
+            row[0] <<= 4;
+            if(c->hires){
+                row[0] |= row[1] >> 60;
+                row[1] <<= 4;
+            }
+        }
+    }
+    c->extensions |= CHIP8_EXT_SCHIP;
+    screen_changed(c);
+    c->PC += 2;
+}
+
+void inst_exit(chip8_t *c){
+    // EXIT - stop the interpreter (SUPER-CHIP), the host sees halted and exited
+    c->exited = 1;
+    c->halted = 1;
+    c->extensions |= CHIP8_EXT_SCHIP;
+}
+
+void inst_set_hires(chip8_t *c, int hires){
+    // LOW / HIGH - 64x32 or 128x64 display, both start out blank
+    c->hires = hires;
+    memset(c->SCREEN, 0, sizeof(c->SCREEN));
+    c->extensions |= CHIP8_EXT_SCHIP;
+    screen_changed(c);
+    c->PC += 2;
+}
+
+void inst_hf_ld(chip8_t *c, uint8_t x){
+    // LD HF, Vx - set I = location of the 10-byte sprite for digit Vx
+    c->I = BIGFONT_ADDR + (c->V[x] & 0xf) * 10;
+    c->extensions |= CHIP8_EXT_SCHIP;
+    c->PC += 2;
+}
+
+void inst_store_flags(chip8_t *c, uint8_t x){
+    // LD R, Vx - save V0..Vx in the user flags
+    memcpy(c->FLAGS, c->V, x + 1);
+    c->extensions |= CHIP8_EXT_SCHIP;
+    c->PC += 2;
+}
+
+void inst_read_flags(chip8_t *c, uint8_t x){
+    // LD Vx, R - restore V0..Vx from the user flags
+    memcpy(c->V, c->FLAGS, x + 1);
+    c->extensions |= CHIP8_EXT_SCHIP;
+    c->PC += 2;
+}
+
+void inst_store_range(chip8_t *c, uint8_t x, uint8_t y){
+    // SAVE Vx - Vy - copy Vx..Vy (either direction) to memory at I, I is unchanged (XO-CHIP)
+    int step = x <= y ? 1 : -1, count = (x <= y ? y - x : x - y) + 1;
+    for(int i = 0; i < count; i++)
+        c->MEMORY[(c->I + i) & MEM_MASK] = c->V[x + i * step];
+    memory_written(c, c->I, count);
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 2;
+}
+
+void inst_read_range(chip8_t *c, uint8_t x, uint8_t y){
+    // LOAD Vx - Vy - read Vx..Vy from memory at I, I is unchanged (XO-CHIP)
+    int step = x <= y ? 1 : -1, count = (x <= y ? y - x : x - y) + 1;
+    for(int i = 0; i < count; i++)
+        c->V[x + i * step] = c->MEMORY[(c->I + i) & MEM_MASK];
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 2;
+}
+
+void inst_ld_i_long(chip8_t *c){
+    // LD I, long - F000 NNNN, I = the 16-bit word after the opcode (XO-CHIP)
+    c->I = c->MEMORY[(c->PC + 2) & MEM_MASK] << 8 | c->MEMORY[(c->PC + 3) & MEM_MASK];
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 4;
+}
+
+void inst_plane(chip8_t *c, uint8_t n){
+    // PLANE n - FN01, select the bitplanes DRW, CLS and the scrolls act on (XO-CHIP)
+    c->planes = n & ((1 << SCRN_PLANES) - 1);
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 2;
+}
+
+void inst_audio(chip8_t *c){
+    // AUDIO - F002, load the 16-byte sample pattern at I (XO-CHIP)
+    for(int i = 0; i < 16; i++)
+        c->AUDIO_PATTERN[i] = c->MEMORY[(c->I + i) & MEM_MASK];
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 2;
+}
+
+void inst_pitch(chip8_t *c, uint8_t x){
+    // PITCH Vx - FX3A, pattern playback at 4000 * 2^((Vx - 64) / 48) Hz (XO-CHIP)
+    c->PITCH = c->V[x];
+    c->extensions |= CHIP8_EXT_XOCHIP;
+    c->PC += 2;
+}
+
+/* opcode class for every (first nibble, low byte) pair, e.g. op_table[0x8][0x14]
+   is OP_ADD_V. Nothing else in an opcode decides its class, so 4 KB covers the
+   whole 64K opcode space. */
+static void build_op_table(void){
+    for(int sb = 0; sb < 256; sb++){
+        op_table[0x0][sb] = OP_SYS;
+        op_table[0x1][sb] = OP_JP;
+        op_table[0x2][sb] = OP_CALL;
+        op_table[0x3][sb] = OP_SE;
+        op_table[0x4][sb] = OP_SNE;
+        op_table[0x5][sb] = (sb & 0x0f) == 0x0 ? OP_SE_V : (sb & 0x0f) == 0x2 ? OP_STORE_R : (sb & 0x0f) == 0x3 ? OP_READ_R : OP_BAD;
+        op_table[0x6][sb] = OP_LD;
+        op_table[0x7][sb] = OP_ADD;
+        op_table[0x9][sb] = (sb & 0x0f) == 0x0 ? OP_SNE_V : OP_BAD;
+        op_table[0xa][sb] = OP_LD_I;
+        op_table[0xb][sb] = OP_JP_V0;
+        op_table[0xc][sb] = OP_RND;
+        op_table[0xd][sb] = OP_DRW;
+        op_table[0xe][sb] = sb == 0x9e ? OP_SKP : sb == 0xa1 ? OP_SKNP : OP_BAD;
+        op_table[0xf][sb] = OP_BAD;
+
+        static const uint8_t alu[16] = {
+            OP_LD_V, OP_OR, OP_AND, OP_XOR, OP_ADD_V, OP_SUB, OP_SHR, OP_SUBN,
+            OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_SHL, OP_BAD
+        };
+        op_table[0x8][sb] = alu[sb & 0x0f];
+    }
+    for(int n = 0; n < 16; n++){
+        op_table[0x0][0xc0 | n] = OP_SCD;
+        op_table[0x0][0xd0 | n] = OP_SCU;
+    }
+    op_table[0x0][0xe0] = OP_CLS;
+    op_table[0x0][0xee] = OP_RET;
+    op_table[0x0][0xfb] = OP_SCR;
+    op_table[0x0][0xfc] = OP_SCL;
+    op_table[0x0][0xfd] = OP_EXIT;
+    op_table[0x0][0xfe] = OP_LOW;
+    op_table[0x0][0xff] = OP_HIGH;
+    op_table[0xf][0x00] = OP_LD_I_LONG;
+    op_table[0xf][0x01] = OP_PLANE;
+    op_table[0xf][0x02] = OP_AUDIO;
+    op_table[0xf][0x07] = OP_LD_DT;
+    op_table[0xf][0x0a] = OP_LD_K;
+    op_table[0xf][0x15] = OP_DT_LD;
+    op_table[0xf][0x18] = OP_ST_LD;
+    op_table[0xf][0x1e] = OP_ADD_I;
+    op_table[0xf][0x29] = OP_F_LD;
+    op_table[0xf][0x30] = OP_HF_LD;
+    op_table[0xf][0x33] = OP_BCD;
+    op_table[0xf][0x3a] = OP_PITCH;
+    op_table[0xf][0x55] = OP_STORE;
+    op_table[0xf][0x65] = OP_READ;
+    op_table[0xf][0x75] = OP_STORE_FL;
+    op_table[0xf][0x85] = OP_READ_FL;
+}
+
+void chip8_decode(uint16_t opcode, chip8_insn_t *in){
+    in->op = op_table[opcode >> 12][opcode & 0xff];
+    in->x = (opcode >> 8) & 0x0f;
+    in->y = (opcode >> 4) & 0x0f;
+    in->n = opcode & 0x0f;
+    in->kk = opcode & 0xff;
+    in->nnn = opcode & 0x0fff;
+}
+
+
+void chip8_set_quirks(chip8_t *c, int quirks){
+    quirks &= CHIP8_QUIRK_ALL;
+    if(c->quirks == quirks)
+        return;
+    c->quirks = quirks;
+    bcache_flush(c); // native code has the old shift and VF behaviour compiled in
+}
+
+// one handler per opcode class, indexed by chip8_insn_t.op
+typedef void (*op_handler_t)(chip8_t *c, const chip8_insn_t *in);
+
+#define INTERP_CAT2(a, b) a##_##b
+#define INTERP_CAT(a, b) INTERP_CAT2(a, b)
+#define INTERP(name) INTERP_CAT(name, INTERP_NAME)
+
+#define INTERP_NAME modern
+#define QUIRKS CHIP8_QUIRKS_MODERN
+#include "interp.h"
+#define INTERP_NAME cosmac
+#define QUIRKS CHIP8_QUIRKS_COSMAC
+#include "interp.h"
+#define INTERP_NAME schip
+#define QUIRKS CHIP8_QUIRKS_SCHIP
+#include "interp.h"
+#define INTERP_NAME xochip
+#define QUIRKS CHIP8_QUIRKS_XOCHIP
+#include "interp.h"
+// any other combination of quirk bits, tested as it runs
+#define INTERP_NAME generic
+#define QUIRKS (c->quirks)
+#include "interp.h"
+
+typedef struct {
+    int (*run)(chip8_t *c, int cycles);
+    int (*cycle)(chip8_t *c);
+    void (*execute)(chip8_t *c, const chip8_insn_t *in);
+    void (*decode_execute)(chip8_t *c, uint16_t opcode);
+} interp_t;
+
+#define X(name, quirks) static const interp_t interp_##name = { run_##name, cycle_##name, execute_##name, decode_execute_##name };
+CHIP8_QUIRK_PROFILES(X)
+X(generic, -1)
+#undef X
+
+// picked once per call, the loops inside never look at c->quirks again
+static const interp_t *interp_for(const chip8_t *c){
+    switch(c->quirks){
+#define X(name, quirks) case quirks: return &interp_##name;
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+        default: return &interp_generic;
+    }
+}
+
+void decodeAndExecute(chip8_t *c, uint16_t opcode){
+    interp_for(c)->decode_execute(c, opcode);
+}
+
+void chip8_execute(chip8_t *c, const chip8_insn_t *in){
+    interp_for(c)->execute(c, in);
+}
+
+int chip8_cycle(chip8_t *c){
+    return interp_for(c)->cycle(c);
+}
+
+#define IDLE_MAX_LOOP 16 // longest spin loop find_spin() follows, in opcodes
+
+/* Opcodes a spin loop may contain: they read memory, timers and keys but
+   write nothing besides V, I and PC. Everything else (stores, draws, the
+   stack, RND, timer writes) has an effect even when it repeats. */
+static int idle_safe(uint8_t op){
+    switch(op){
+        case OP_SYS: case OP_JP: case OP_JP_V0: case OP_BAD:
+        case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: case OP_SKP: case OP_SKNP:
+        case OP_LD: case OP_ADD: case OP_LD_V: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_V: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_LD_I_LONG: case OP_ADD_I: case OP_F_LD: case OP_HF_LD:
+        case OP_LD_DT: case OP_READ: case OP_READ_R: case OP_READ_FL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Step up to two trips around the loop at PC. If one trip comes back to PC
+   with V and I as they were, every later trip does exactly the same until DT
+   or KEYBOARD change, which only happens between chip8_run() calls. Returns
+   the trip length in opcodes, 0 if this is not such a loop; `*executed`
+   counts the opcodes stepped either way. */
+static int find_spin(chip8_t *c, const interp_t *interp, int cycles, int *executed){
+    uint16_t head = c->PC;
+    // the first trip may still be settling, e.g. FX07 loading a new DT
+    for(int trip = 0; trip < 2; trip++){
+        uint8_t V[16];
+        memcpy(V, c->V, sizeof(V));
+        uint16_t I = c->I;
+        int length = 0;
+        do {
+            if(*executed == cycles || length == IDLE_MAX_LOOP || c->halted || c->waiting_for_key)
+                return 0;
+            chip8_insn_t in;
+            chip8_decode(c->MEMORY[c->PC & MEM_MASK] << 8 | c->MEMORY[(c->PC + 1) & MEM_MASK], &in);
+            if(!idle_safe(in.op))
+                return 0;
+            interp->cycle(c);
+            (*executed)++;
+            length++;
+        } while(c->PC != head);
+        if(memcmp(V, c->V, sizeof(V)) == 0 && I == c->I)
+            return length;
+    }
+    return 0;
+}
+
+int chip8_run(chip8_t *c, int cycles){
+    const interp_t *interp = interp_for(c);
+    c->idle = 0;
+    if(!c->idle_skip || c->profile)
+        return interp->run(c, cycles); // a profile counts every opcode, skipped ones too
+
+    int executed = 0;
+    int length = find_spin(c, interp, cycles, &executed);
+    if(length){
+        // whole trips change nothing but the cycle count, the remainder runs for real
+        int skipped = (cycles - executed) / length * length;
+        c->cycles += skipped;
+        c->idle_cycles += skipped;
+        executed += skipped;
+        c->idle = 1;
+    }
+    if(executed < cycles)
+        executed += interp->run(c, cycles - executed);
+    if(c->waiting_for_key && c->key_press_buffer == -1)
+        c->idle = 1; // FX0A with no key yet, a title screen or menu waiting for input
+    return executed;
+}
@@ -0,0 +1,301 @@
+// CHIP-8 interpreter core (no SDL dependency)
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MEM_SIZE 65536 // XO-CHIP address space, classic ROMs only use the first 4 KB
+#define MEM_MASK (MEM_SIZE - 1) // addresses wrap instead of running off MEMORY
+#define STCK_SIZE 16
+#define CHIP8_PAGE_SHIFT 8 // MEMORY writes are tracked in 256-byte pages, see written_pages
+#define SCRN_WIDTH 64 // low-res (CHIP-8) display
+#define SCRN_HEIGHT 32
+#define SCRN_SIZE 64*32
+#define SCRN_HIRES_WIDTH 128 // SUPER-CHIP / XO-CHIP 00FF
+#define SCRN_HIRES_HEIGHT 64
+#define SCRN_PLANES 2 // XO-CHIP bitplanes, pixel color = plane bits (plane 1 is bit 1)
+#define BIGFONT_ADDR 0x50 // 10-byte FX30 digits, right after the 5-byte ones
+
+// instruction set extensions a ROM has used, in chip8_t.extensions
+#define CHIP8_EXT_SCHIP 1
+#define CHIP8_EXT_XOCHIP 2
+
+/* Behaviours the CHIP-8 variants disagree on, in chip8_t.quirks. 0 is this
+   interpreter's historical behaviour, each bit switches one of them over. */
+#define CHIP8_QUIRK_SHIFT_VY 1 // 8XY6/8XYE shift Vy into Vx (COSMAC VIP) instead of shifting Vx
+#define CHIP8_QUIRK_MEM_I 2 // FX55/FX65 leave I pointing past the last register
+#define CHIP8_QUIRK_JUMP_VX 4 // BXNN jumps to XNN + VX (SUPER-CHIP) instead of NNN + V0
+#define CHIP8_QUIRK_VF_RESET 8 // 8XY1/8XY2/8XY3 clear VF
+#define CHIP8_QUIRK_CLIP 16 // sprites are cut off at the screen edges instead of wrapping around
+#define CHIP8_QUIRK_ALL 31
+
+/* Named quirk profiles. chip8.c builds one interpreter per profile with its
+   quirks as constants, so running one costs no flag tests; any other mix of
+   bits goes through a generic interpreter that reads chip8_t.quirks. */
+#define CHIP8_QUIRKS_MODERN 0
+#define CHIP8_QUIRKS_COSMAC (CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_MEM_I | CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_CLIP)
+#define CHIP8_QUIRKS_SCHIP (CHIP8_QUIRK_JUMP_VX | CHIP8_QUIRK_CLIP)
+#define CHIP8_QUIRKS_XOCHIP (CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_MEM_I)
+#define CHIP8_QUIRK_PROFILES(X) \
+    X(modern, CHIP8_QUIRKS_MODERN) \
+    X(cosmac, CHIP8_QUIRKS_COSMAC) \
+    X(schip,  CHIP8_QUIRKS_SCHIP) \
+    X(xochip, CHIP8_QUIRKS_XOCHIP)
+
+// Opcode dispatch strategy, chosen at build time with -DCHIP8_DISPATCH=<n>
+#define CHIP8_DISPATCH_SWITCH 0 // nested switch on the opcode nibbles
+#define CHIP8_DISPATCH_TABLE  1 // 16x256 opcode class table + handler pointer table
+#define CHIP8_DISPATCH_GOTO   2 // table decode + computed-goto threaded chip8_run (GNU C)
+#ifndef CHIP8_DISPATCH
+#define CHIP8_DISPATCH CHIP8_DISPATCH_GOTO
+#endif
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO && !defined(__GNUC__)
+#undef CHIP8_DISPATCH
+#define CHIP8_DISPATCH CHIP8_DISPATCH_TABLE
+#endif
+
+typedef struct chip8 {
+    // common-use registers
+    uint8_t V[16]; //V[0]-V[0xF]
+    uint8_t DT, ST; // delay timer and song timer
+    uint16_t PC, I; // instruction pointer and memory register
+    uint8_t SP; // stack pointer
+
+    // hidden registers
+    int waiting_for_key, key_dest;
+    int draw_screen_flag; // 1 when DRW called
+    int key_press_buffer; // Stores the value of the *single* key just pressed for FX0A, -1 if none
+    uint32_t rng; // xorshift32 state for RND, private to this machine
+    int halted; // set on stack overflow/underflow, the machine stops executing
+    uint64_t cycles; // opcodes executed since init_machine
+
+    uint8_t MEMORY[MEM_SIZE];
+    uint16_t STACK[STCK_SIZE]; // stack
+    /* display as packed bitplanes: SCREEN[plane][row] is one row, two words wide,
+       bit 63 of word 0 is the leftmost pixel. Low-res mode only uses word 0 of
+       rows 0-31, so a classic ROM draws exactly as it did on one 64-bit row. */
+    uint64_t SCREEN[SCRN_PLANES][SCRN_HIRES_HEIGHT][2];
+    uint8_t hires; // 128x64 mode (00FF) instead of 64x32 (00FE)
+    uint8_t planes; // XO-CHIP FN01 plane mask that DRW, CLS and the scrolls act on, 1 by default
+    uint8_t exited; // 00FD ran, halted is set too
+    uint8_t extensions; // CHIP8_EXT_* opcodes seen since init_machine
+    uint8_t KEYBOARD[16];
+    uint8_t FLAGS[16]; // SUPER-CHIP FX75/FX85 user flags
+    uint8_t AUDIO_PATTERN[16]; // XO-CHIP F002 sample bits, kept for the host
+    uint8_t PITCH; // XO-CHIP FX3A playback rate of AUDIO_PATTERN
+    uint8_t quirks; // CHIP8_QUIRK_* this machine runs with, kept by init_machine
+
+    // host-side caches, everything above is the machine state (CHIP8_STATE_SIZE)
+    struct chip8_bcache *bcache; // pre-decoded blocks, NULL when disabled
+    struct chip8_jit *jit; // native code for hot blocks, NULL when disabled
+    struct chip8_profile *profile; // execution counters, NULL unless enabled in a CHIP8_PROFILE build
+    int idle_skip; // let chip8_run() fast-forward spin loops, see below
+    int idle; // the last chip8_run() ended in a spin loop
+    uint64_t idle_cycles; // opcodes counted in `cycles` that a spin loop skipped instead of running
+    uint64_t written_pages[(MEM_SIZE >> CHIP8_PAGE_SHIFT) / 64]; // bit per MEMORY page written, cleared by snapshot.c
+    uint64_t rewind_pages[(MEM_SIZE >> CHIP8_PAGE_SHIFT) / 64]; // the same, cleared by rewind.c
+} chip8_t;
+
+/* Save states are the header below followed by the first CHIP8_STATE_SIZE
+   bytes of chip8_t, as is. Any change to the layout above must bump
+   CHIP8_STATE_VERSION so old files are refused instead of misread. */
+#define CHIP8_STATE_MAGIC "C8SV"
+#define CHIP8_STATE_VERSION 4
+#define CHIP8_STATE_SIZE offsetof(chip8_t, bcache)
+
+typedef struct {
+    char magic[4]; // CHIP8_STATE_MAGIC
+    uint32_t version; // CHIP8_STATE_VERSION, also tells the byte order apart
+    uint32_t size; // CHIP8_STATE_SIZE of the writer
+    uint32_t checksum; // FNV-1a of the state bytes
+} chip8_state_header_t;
+
+// An opcode with its class and operands already extracted
+typedef struct {
+    uint8_t op; // one of the OP_* below
+    uint8_t x, y, n; // second, third and fourth nibble
+    uint8_t kk; // low byte
+    uint16_t nnn; // low 12 bits
+} chip8_insn_t;
+
+/* Every opcode class and what executing it does, `c` is the machine and `in`
+   the decoded chip8_insn_t. CHIP-8, then the SUPER-CHIP and XO-CHIP additions;
+   anything else is BAD and skipped. F000 NNNN is the one 4-byte opcode, the
+   skips step over it whole. Bodies that depend on a quirk pass QUIRKS, which
+   each expansion defines as its profile's constant (or as c->quirks). */
+#define CHIP8_OPS(X) \
+    X(CLS,      inst_cls(c)) \
+    X(RET,      inst_ret(c)) \
+    X(SYS,      c->PC += 2) \
+    X(JP,       inst_jp(c, in->nnn)) \
+    X(CALL,     inst_call(c, in->nnn)) \
+    X(SE,       inst_se(c, in->x, in->kk)) \
+    X(SNE,      inst_sne(c, in->x, in->kk)) \
+    X(SE_V,     inst_se(c, in->x, c->V[in->y])) \
+    X(LD,       inst_ld(c, in->x, in->kk)) \
+    X(ADD,      inst_add(c, in->x, in->kk)) \
+    X(LD_V,     inst_ld(c, in->x, c->V[in->y])) \
+    X(OR,       inst_or_q(c, in->x, in->y, QUIRKS)) \
+    X(AND,      inst_and_q(c, in->x, in->y, QUIRKS)) \
+    X(XOR,      inst_xor_q(c, in->x, in->y, QUIRKS)) \
+    X(ADD_V,    inst_add_vx_vy(c, in->x, in->y)) \
+    X(SUB,      inst_sub_vx_vy(c, in->x, in->y)) \
+    X(SHR,      inst_shr_q(c, in->x, in->y, QUIRKS)) \
+    X(SUBN,     inst_subn_vx_vy(c, in->x, in->y)) \
+    X(SHL,      inst_shl_q(c, in->x, in->y, QUIRKS)) \
+    X(SNE_V,    inst_sne(c, in->x, c->V[in->y])) \
+    X(LD_I,     inst_ld_addr(c, in->nnn)) \
+    X(JP_V0,    inst_jp_v0_q(c, in->nnn, QUIRKS)) \
+    X(RND,      inst_rnd(c, in->x, in->kk)) \
+    X(DRW,      inst_drw_q(c, in->x, in->y, in->n, QUIRKS)) \
+    X(SKP,      inst_skp(c, in->x)) \
+    X(SKNP,     inst_sknp(c, in->x)) \
+    X(LD_DT,    inst_ld_dt(c, in->x)) \
+    X(LD_K,     inst_ld_k(c, in->x)) \
+    X(DT_LD,    inst_dt_ld(c, in->x)) \
+    X(ST_LD,    inst_st_ld(c, in->x)) \
+    X(ADD_I,    inst_add_i(c, in->x)) \
+    X(F_LD,     inst_f_ld(c, in->x)) \
+    X(BCD,      inst_bcd_ld(c, in->x)) \
+    X(STORE,    inst_store_registers_q(c, in->x, QUIRKS)) \
+    X(READ,     inst_read_registers_q(c, in->x, QUIRKS)) \
+    X(SCD,      inst_scroll_down(c, in->n)) \
+    X(SCU,      inst_scroll_up(c, in->n)) \
+    X(SCR,      inst_scroll_right(c)) \
+    X(SCL,      inst_scroll_left(c)) \
+    X(EXIT,     inst_exit(c)) \
+    X(LOW,      inst_set_hires(c, 0)) \
+    X(HIGH,     inst_set_hires(c, 1)) \
+    X(HF_LD,    inst_hf_ld(c, in->x)) \
+    X(STORE_FL, inst_store_flags(c, in->x)) \
+    X(READ_FL,  inst_read_flags(c, in->x)) \
+    X(STORE_R,  inst_store_range(c, in->x, in->y)) \
+    X(READ_R,   inst_read_range(c, in->x, in->y)) \
+    X(LD_I_LONG, inst_ld_i_long(c)) \
+    X(PLANE,    inst_plane(c, in->x)) \
+    X(AUDIO,    inst_audio(c)) \
+    X(PITCH,    inst_pitch(c, in->x)) \
+    X(BAD,      c->PC += 2)
+
+enum {
+#define X(name, body) OP_##name,
+    CHIP8_OPS(X)
+#undef X
+    OP_COUNT
+};
+
+extern const uint8_t fontset[80];
+extern const uint8_t bigfontset[160];
+
+// A chip8_t must start zeroed (static or calloc); init_machine keeps any
+// attached caches and only flushes them.
+void init_machine(chip8_t *c);
+int load_rom(chip8_t *c, const char* filename);
+int load_rom_data(chip8_t *c, const uint8_t *data, long size);
+void chip8_seed(chip8_t *c, uint32_t seed);
+// Switch to other CHIP8_QUIRK_* bits, dropping blocks and native code built for the old ones
+void chip8_set_quirks(chip8_t *c, int quirks);
+
+// Run steady-state code from pre-decoded basic blocks instead of fetching and
+// decoding every opcode. Costs ~200 KB per machine.
+int chip8_bcache_enable(chip8_t *c);
+void chip8_bcache_disable(chip8_t *c);
+
+// Compile hot blocks to x86-64 code (enables the block cache too). Returns 0
+// where there is no JIT for the host; the interpreter then runs everything.
+int chip8_jit_enable(chip8_t *c);
+void chip8_jit_disable(chip8_t *c);
+
+// Count opcode classes, per-PC hits and call paths. Returns 0 unless built with
+// -DCHIP8_PROFILE, without it the hooks compile to nothing. Native JIT code is
+// not counted, so a profiling build has no JIT. chip8_profile_write() writes
+// <prefix>.folded (collapsed stacks for flame graphs) and <prefix>.json.
+int chip8_profile_enable(chip8_t *c);
+void chip8_profile_disable(chip8_t *c);
+int chip8_profile_write(chip8_t *c, const char *prefix);
+
+// Fetch, decode and execute one opcode at PC. While an FX0A is pending this
+// only checks key_press_buffer; returns 1 when an opcode was executed.
+int chip8_cycle(chip8_t *c);
+/* Run `cycles` opcodes, fewer when the machine halts or FX0A waits. With
+   idle_skip set, a loop that polls DT or the keys and writes nothing but
+   registers it rewrites with the same values (FX07; 3X00; 1NNN) is stepped
+   until that is certain and the rest of the budget is then added to `cycles`
+   without running it: the machine ends in the state it would have reached.
+   `idle` then tells the host that nothing changes before the next
+   chip8_tick_timers() or key event, so it can sleep until then; it is also
+   set when the run ends with FX0A still waiting for a key. */
+int chip8_run(chip8_t *c, int cycles);
+void chip8_tick_timers(chip8_t *c);
+void chip8_key_down(chip8_t *c, uint8_t key);
+void chip8_key_up(chip8_t *c, uint8_t key);
+uint64_t chip8_screen_hash(const chip8_t *c);
+// Display size in the current mode, 64x32 or 128x64
+int chip8_screen_width(const chip8_t *c);
+int chip8_screen_height(const chip8_t *c);
+// Expand rows of the current mode to ARGB8888 pixels, `pitch` bytes apart in `pixels`
+void chip8_screen_to_argb(const chip8_t *c, uint32_t *pixels, int pitch, int first_row, int num_rows);
+// The same for a copy of SCREEN taken off the machine, e.g. by a render thread
+void chip8_planes_to_argb(const uint64_t screen[SCRN_PLANES][SCRN_HIRES_HEIGHT][2], int hires,
+                          uint32_t *pixels, int pitch, int first_row, int num_rows);
+
+// Save/load the machine to/from a file, 1 on success; loading leaves `c` untouched on failure
+int chip8_save_state(const chip8_t *c, const char *path);
+int chip8_load_state(chip8_t *c, const char *path);
+// Copy CHIP8_STATE_SIZE bytes of state into `c` and drop everything decoded from the old MEMORY
+void chip8_restore(chip8_t *c, const void *state);
+
+void error_out_of_stack(chip8_t *c);
+void decodeAndExecute(chip8_t *c, uint16_t opcode);
+void chip8_decode(uint16_t opcode, chip8_insn_t *in);
+void chip8_execute(chip8_t *c, const chip8_insn_t *in);
+
+void inst_cls(chip8_t *c);
+void inst_ret(chip8_t *c);
+void inst_jp(chip8_t *c, uint16_t address);
+void inst_call(chip8_t *c, uint16_t address);
+void inst_se(chip8_t *c, uint8_t x, uint8_t kk);
+void inst_sne(chip8_t *c, uint8_t x, uint8_t kk);
+void inst_ld(chip8_t *c, uint8_t x, uint8_t kk);
+void inst_add(chip8_t *c, uint8_t x, uint8_t kk);
+void inst_or(chip8_t *c, uint8_t x, uint8_t y);
+void inst_and(chip8_t *c, uint8_t x, uint8_t y);
+void inst_xor(chip8_t *c, uint8_t x, uint8_t y);
+void inst_add_vx_vy(chip8_t *c, uint8_t x, uint8_t y);
+void inst_sub_vx_vy(chip8_t *c, uint8_t x, uint8_t y);
+void inst_shr(chip8_t *c, uint8_t x, uint8_t y);
+void inst_subn_vx_vy(chip8_t *c, uint8_t x, uint8_t y);
+void inst_shl(chip8_t *c, uint8_t x, uint8_t y);
+void inst_ld_addr(chip8_t *c, uint16_t addr);
+void inst_jp_v0(chip8_t *c, uint16_t addr);
+void inst_rnd(chip8_t *c, uint8_t x, uint8_t kk);
+void inst_drw(chip8_t *c, uint8_t x, uint8_t y, uint8_t n);
+void inst_skp(chip8_t *c, uint8_t x);
+void inst_sknp(chip8_t *c, uint8_t x);
+void inst_ld_dt(chip8_t *c, uint8_t x);
+void inst_ld_k(chip8_t *c, uint8_t x);
+void inst_dt_ld(chip8_t *c, uint8_t x);
+void inst_st_ld(chip8_t *c, uint8_t x);
+void inst_add_i(chip8_t *c, uint8_t x);
+void inst_f_ld(chip8_t *c, uint8_t x);
+void inst_bcd_ld(chip8_t *c, uint8_t x);
+void inst_store_registers(chip8_t *c, uint8_t x);
+void inst_read_registers(chip8_t *c, uint8_t x);
+void inst_scroll_down(chip8_t *c, uint8_t n);
+void inst_scroll_up(chip8_t *c, uint8_t n);
+void inst_scroll_right(chip8_t *c);
+void inst_scroll_left(chip8_t *c);
+void inst_exit(chip8_t *c);
+void inst_set_hires(chip8_t *c, int hires);
+void inst_hf_ld(chip8_t *c, uint8_t x);
+void inst_store_flags(chip8_t *c, uint8_t x);
+void inst_read_flags(chip8_t *c, uint8_t x);
+void inst_store_range(chip8_t *c, uint8_t x, uint8_t y);
+void inst_read_range(chip8_t *c, uint8_t x, uint8_t y);
+void inst_ld_i_long(chip8_t *c);
+void inst_plane(chip8_t *c, uint8_t n);
+void inst_audio(chip8_t *c);
+void inst_pitch(chip8_t *c, uint8_t x);
+
+#endif
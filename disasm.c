@@ -0,0 +1,432 @@
+// Static disassembler: recursive descent from the entry point into a control-flow graph of basic blocks
+#include <stdlib.h>
+#include <string.h>
+#include "disasm.h"
+#include "bcache.h"
+#include "jit.h"
+
+#define SPRITE_PREVIEW_ROWS 15 // data bytes drawn as pixels after an ANNN target, DXYN draws at most 15
+
+static uint16_t word_at(const chip8_t *c, uint16_t addr){
+    return c->MEMORY[addr & MEM_MASK] << 8 | c->MEMORY[(addr + 1) & MEM_MASK];
+}
+
+// a skip steps over F000 NNNN whole, like skip_next() in the interpreter
+static uint16_t skip_target(const chip8_t *c, uint16_t next){
+    return next + (word_at(c, next) == 0xf000 ? 4 : 2);
+}
+
+static int ends_block(uint8_t op){
+    switch(op){
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0: case OP_EXIT:
+        case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: case OP_SKP: case OP_SKNP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+typedef struct {
+    uint16_t *addrs;
+    int len, cap;
+} worklist_t;
+
+static int push(chip8_cfg_t *cfg, worklist_t *w, uint16_t addr, uint8_t flag){
+    addr &= MEM_MASK;
+    cfg->flags[addr] |= DISASM_LEADER | flag;
+    if(cfg->flags[addr] & DISASM_CODE)
+        return 1; // already disassembled
+    if(w->len == w->cap){
+        w->cap = w->cap ? w->cap * 2 : 256;
+        uint16_t *grown = realloc(w->addrs, w->cap * sizeof(uint16_t));
+        if(grown == NULL)
+            return 0;
+        w->addrs = grown;
+    }
+    w->addrs[w->len++] = addr;
+    return 1;
+}
+
+/* BNNN goes to NNN + V0 (or + VX), anywhere in NNN..NNN+255. Its base is
+   followed, and so is the jump table ROMs put there: the run of 1NNN words
+   starting at the base. */
+static int follow_indirect(chip8_cfg_t *cfg, worklist_t *w, const chip8_t *c, uint16_t base){
+    cfg->indirect_jumps++;
+    int ok = push(cfg, w, base, DISASM_INDIRECT);
+    for(int k = 2; ok && k < 256 && (word_at(c, base + k - 2) >> 12) == 0x1 && (word_at(c, base + k) >> 12) == 0x1; k += 2)
+        ok = push(cfg, w, base + k, DISASM_INDIRECT);
+    return ok;
+}
+
+// Follow straight-line code from `addr` until it leaves or meets code already seen
+static int descend(chip8_cfg_t *cfg, worklist_t *w, const chip8_t *c, uint16_t addr){
+    for(;;){
+        uint8_t *f = cfg->flags;
+        if(f[addr] & DISASM_CODE)
+            return 1;
+        if(addr > MEM_SIZE - 2)
+            return 1; // the machine would wrap around, a static pass stops here
+        if(word_at(c, addr) == 0x0000)
+            return 1; // empty memory: the interpreter would walk through it as SYS, not worth following
+        if(f[addr] & DISASM_OPERAND){
+            f[addr] |= DISASM_OVERLAP;
+            cfg->overlaps++;
+        }
+
+        chip8_insn_t in;
+        chip8_decode(word_at(c, addr), &in);
+        f[addr] |= DISASM_CODE;
+        f[addr + 1] |= DISASM_OPERAND;
+        cfg->code_bytes += 2;
+        uint16_t next = addr + 2;
+
+        switch(in.op){
+            case OP_JP:
+                return push(cfg, w, in.nnn, DISASM_JUMP_TARGET);
+            case OP_CALL:
+                return push(cfg, w, in.nnn, DISASM_CALL_TARGET) && push(cfg, w, next, 0);
+            case OP_RET: case OP_EXIT:
+                return 1;
+            case OP_JP_V0:
+                return follow_indirect(cfg, w, c, in.nnn);
+            case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: case OP_SKP: case OP_SKNP:
+                return push(cfg, w, next, 0) && push(cfg, w, skip_target(c, next), DISASM_JUMP_TARGET);
+            case OP_LD_I:
+                f[in.nnn] |= DISASM_DATA_REF;
+                break;
+            case OP_LD_I_LONG:
+                f[next & MEM_MASK] |= DISASM_OPERAND;
+                f[(next + 1) & MEM_MASK] |= DISASM_OPERAND;
+                f[word_at(c, next)] |= DISASM_DATA_REF;
+                cfg->code_bytes += 2;
+                next += 2;
+                break;
+        }
+        addr = next;
+    }
+}
+
+static int add_block(chip8_cfg_t *cfg, const chip8_t *c, uint16_t start, uint16_t last, uint16_t end, int *cap){
+    if(cfg->num_blocks == *cap){
+        *cap = *cap ? *cap * 2 : 64;
+        chip8_cfg_block_t *grown = realloc(cfg->blocks, *cap * sizeof(chip8_cfg_block_t));
+        if(grown == NULL)
+            return 0;
+        cfg->blocks = grown;
+    }
+    chip8_cfg_block_t *b = &cfg->blocks[cfg->num_blocks++];
+    memset(b, 0, sizeof(*b));
+    b->start = start;
+    b->last = last;
+    b->end = end;
+
+    chip8_insn_t in;
+    chip8_decode(word_at(c, last), &in);
+    switch(in.op){
+        case OP_JP:
+            b->end_kind = CFG_JUMP;
+            b->succ[b->num_succ++] = in.nnn;
+            break;
+        case OP_CALL:
+            b->end_kind = CFG_CALL;
+            b->target = in.nnn;
+            b->succ[b->num_succ++] = end; // where RET comes back to
+            break;
+        case OP_RET:
+            b->end_kind = CFG_RET;
+            break;
+        case OP_EXIT:
+            b->end_kind = CFG_HALT;
+            break;
+        case OP_JP_V0:
+            b->end_kind = CFG_INDIRECT;
+            b->target = in.nnn;
+            break;
+        case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: case OP_SKP: case OP_SKNP:
+            b->end_kind = CFG_SKIP;
+            b->succ[b->num_succ++] = end;
+            b->succ[b->num_succ++] = skip_target(c, end);
+            break;
+        default:
+            b->end_kind = CFG_FALL;
+            if(end < MEM_SIZE && (cfg->flags[end] & DISASM_CODE))
+                b->succ[b->num_succ++] = end;
+            break;
+    }
+    return 1;
+}
+
+int chip8_cfg_build(chip8_cfg_t *cfg, const chip8_t *c){
+    memset(cfg, 0, sizeof(*cfg));
+    worklist_t w = {0};
+    int ok = push(cfg, &w, c->PC, DISASM_JUMP_TARGET);
+    for(int sp = 1; ok && sp <= c->SP && sp < STCK_SIZE; sp++)
+        ok = push(cfg, &w, c->STACK[sp] + 2, 0); // where pending RETs go
+    while(ok && w.len > 0)
+        ok = descend(cfg, &w, c, w.addrs[--w.len]);
+    free(w.addrs);
+
+    // blocks: runs of code from a leader up to a branch, the next leader or a gap
+    int cap = 0;
+    for(int addr = 0; ok && addr < MEM_SIZE; ){
+        if(!(cfg->flags[addr] & DISASM_CODE)){
+            addr++;
+            continue;
+        }
+        int start = addr, last;
+        for(;;){
+            last = addr;
+            chip8_insn_t in;
+            chip8_decode(word_at(c, addr), &in);
+            addr += in.op == OP_LD_I_LONG ? 4 : 2;
+            if(ends_block(in.op) || addr >= MEM_SIZE - 1)
+                break;
+            if(!(cfg->flags[addr] & DISASM_CODE) || (cfg->flags[addr] & DISASM_LEADER))
+                break;
+        }
+        ok = add_block(cfg, c, start, last, addr < MEM_SIZE ? addr : MEM_SIZE - 1, &cap);
+    }
+    if(!ok)
+        chip8_cfg_free(cfg);
+    return ok;
+}
+
+void chip8_cfg_free(chip8_cfg_t *cfg){
+    free(cfg->blocks);
+    cfg->blocks = NULL;
+    cfg->num_blocks = 0;
+}
+
+int chip8_cfg_find(const chip8_cfg_t *cfg, uint16_t addr){
+    int lo = 0, hi = cfg->num_blocks - 1;
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        const chip8_cfg_block_t *b = &cfg->blocks[mid];
+        if(addr < b->start)
+            hi = mid - 1;
+        else if(addr >= b->end)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+int chip8_disasm_insn(uint16_t opcode, uint16_t operand, char *buf, size_t size){
+    chip8_insn_t in;
+    chip8_decode(opcode, &in);
+    int x = in.x, y = in.y;
+    switch(in.op){
+        case OP_CLS:      snprintf(buf, size, "CLS"); break;
+        case OP_RET:      snprintf(buf, size, "RET"); break;
+        case OP_SYS:      snprintf(buf, size, "SYS  %03X", in.nnn); break;
+        case OP_JP:       snprintf(buf, size, "JP   %03X", in.nnn); break;
+        case OP_CALL:     snprintf(buf, size, "CALL %03X", in.nnn); break;
+        case OP_SE:       snprintf(buf, size, "SE   V%X, %02X", x, in.kk); break;
+        case OP_SNE:      snprintf(buf, size, "SNE  V%X, %02X", x, in.kk); break;
+        case OP_SE_V:     snprintf(buf, size, "SE   V%X, V%X", x, y); break;
+        case OP_LD:       snprintf(buf, size, "LD   V%X, %02X", x, in.kk); break;
+        case OP_ADD:      snprintf(buf, size, "ADD  V%X, %02X", x, in.kk); break;
+        case OP_LD_V:     snprintf(buf, size, "LD   V%X, V%X", x, y); break;
+        case OP_OR:       snprintf(buf, size, "OR   V%X, V%X", x, y); break;
+        case OP_AND:      snprintf(buf, size, "AND  V%X, V%X", x, y); break;
+        case OP_XOR:      snprintf(buf, size, "XOR  V%X, V%X", x, y); break;
+        case OP_ADD_V:    snprintf(buf, size, "ADD  V%X, V%X", x, y); break;
+        case OP_SUB:      snprintf(buf, size, "SUB  V%X, V%X", x, y); break;
+        case OP_SHR:      snprintf(buf, size, "SHR  V%X, V%X", x, y); break;
+        case OP_SUBN:     snprintf(buf, size, "SUBN V%X, V%X", x, y); break;
+        case OP_SHL:      snprintf(buf, size, "SHL  V%X, V%X", x, y); break;
+        case OP_SNE_V:    snprintf(buf, size, "SNE  V%X, V%X", x, y); break;
+        case OP_LD_I:     snprintf(buf, size, "LD   I, %03X", in.nnn); break;
+        case OP_JP_V0:    snprintf(buf, size, "JP   V0, %03X", in.nnn); break;
+        case OP_RND:      snprintf(buf, size, "RND  V%X, %02X", x, in.kk); break;
+        case OP_DRW:      snprintf(buf, size, "DRW  V%X, V%X, %X", x, y, in.n); break;
+        case OP_SKP:      snprintf(buf, size, "SKP  V%X", x); break;
+        case OP_SKNP:     snprintf(buf, size, "SKNP V%X", x); break;
+        case OP_LD_DT:    snprintf(buf, size, "LD   V%X, DT", x); break;
+        case OP_LD_K:     snprintf(buf, size, "LD   V%X, K", x); break;
+        case OP_DT_LD:    snprintf(buf, size, "LD   DT, V%X", x); break;
+        case OP_ST_LD:    snprintf(buf, size, "LD   ST, V%X", x); break;
+        case OP_ADD_I:    snprintf(buf, size, "ADD  I, V%X", x); break;
+        case OP_F_LD:     snprintf(buf, size, "LD   F, V%X", x); break;
+        case OP_BCD:      snprintf(buf, size, "LD   B, V%X", x); break;
+        case OP_STORE:    snprintf(buf, size, "LD   [I], V%X", x); break;
+        case OP_READ:     snprintf(buf, size, "LD   V%X, [I]", x); break;
+        case OP_SCD:      snprintf(buf, size, "SCD  %X", in.n); break;
+        case OP_SCU:      snprintf(buf, size, "SCU  %X", in.n); break;
+        case OP_SCR:      snprintf(buf, size, "SCR"); break;
+        case OP_SCL:      snprintf(buf, size, "SCL"); break;
+        case OP_EXIT:     snprintf(buf, size, "EXIT"); break;
+        case OP_LOW:      snprintf(buf, size, "LOW"); break;
+        case OP_HIGH:     snprintf(buf, size, "HIGH"); break;
+        case OP_HF_LD:    snprintf(buf, size, "LD   HF, V%X", x); break;
+        case OP_STORE_FL: snprintf(buf, size, "LD   R, V%X", x); break;
+        case OP_READ_FL:  snprintf(buf, size, "LD   V%X, R", x); break;
+        case OP_STORE_R:  snprintf(buf, size, "SAVE V%X - V%X", x, y); break;
+        case OP_READ_R:   snprintf(buf, size, "LOAD V%X - V%X", x, y); break;
+        case OP_LD_I_LONG: snprintf(buf, size, "LD   I, %04X", operand); return 4;
+        case OP_PLANE:    snprintf(buf, size, "PLANE %X", x); break;
+        case OP_AUDIO:    snprintf(buf, size, "AUDIO"); break;
+        case OP_PITCH:    snprintf(buf, size, "PITCH V%X", x); break;
+        default:          snprintf(buf, size, "DW   %04X", opcode); break;
+    }
+    return 2;
+}
+
+static void print_labels(FILE *out, uint8_t f, uint16_t addr){
+    if(f & DISASM_CALL_TARGET)
+        fprintf(out, "sub_%03X:\n", addr);
+    else if(f & (DISASM_JUMP_TARGET | DISASM_INDIRECT))
+        fprintf(out, "L_%03X:\n", addr);
+    if(f & DISASM_DATA_REF)
+        fprintf(out, "data_%03X:\n", addr);
+}
+
+static void print_code(FILE *out, const chip8_cfg_t *cfg, const chip8_t *c, uint16_t addr, int *size){
+    char text[32], note[48] = "";
+    uint16_t opcode = word_at(c, addr);
+    *size = chip8_disasm_insn(opcode, word_at(c, addr + 2), text, sizeof(text));
+
+    chip8_insn_t in;
+    chip8_decode(opcode, &in);
+    if(cfg->flags[addr] & DISASM_OVERLAP)
+        snprintf(note, sizeof(note), "overlaps the opcode before");
+    else if(in.op == OP_CALL)
+        snprintf(note, sizeof(note), "sub_%03X", in.nnn);
+    else if(in.op == OP_JP)
+        snprintf(note, sizeof(note), in.nnn == addr ? "halt loop" : "L_%03X", in.nnn);
+    else if(in.op == OP_JP_V0)
+        snprintf(note, sizeof(note), "indirect, %03X..%03X", in.nnn, in.nnn + 255);
+    else if(in.op == OP_LD_I && !(cfg->flags[in.nnn] & DISASM_CODE))
+        snprintf(note, sizeof(note), "data_%03X", in.nnn);
+    else if(in.op == OP_LD_K)
+        snprintf(note, sizeof(note), "waits for a key");
+
+    if(*size == 4)
+        fprintf(out, "  %03X  %04X %04X  ", addr, opcode, word_at(c, addr + 2));
+    else
+        fprintf(out, "  %03X  %04X       ", addr, opcode);
+    if(note[0])
+        fprintf(out, "%-16s ; %s\n", text, note);
+    else
+        fprintf(out, "%s\n", text);
+}
+
+void chip8_cfg_listing(const chip8_cfg_t *cfg, const chip8_t *c, uint16_t from, uint16_t to, FILE *out){
+    fprintf(out, "; %d blocks, %d bytes of code, %d indirect jumps, %d overlapping opcodes\n",
+            cfg->num_blocks, cfg->code_bytes, cfg->indirect_jumps, cfg->overlaps);
+    int sprite_rows = 0; // data rows still drawn as pixels after a data label
+    for(uint32_t addr = from; addr < to; ){
+        uint8_t f = cfg->flags[addr];
+        if(f & DISASM_CODE){
+            if(f & DISASM_LEADER)
+                fprintf(out, "\n");
+            print_labels(out, f, addr);
+            int size;
+            print_code(out, cfg, c, addr, &size);
+            addr += size;
+            sprite_rows = 0;
+            continue;
+        }
+
+        // data: one row per byte with its pixels under a data label, else up to 8 per line
+        if(f & DISASM_DATA_REF){
+            fprintf(out, "\n");
+            print_labels(out, f, addr);
+            sprite_rows = SPRITE_PREVIEW_ROWS;
+        }
+        if(sprite_rows > 0){
+            uint8_t byte = c->MEMORY[addr];
+            fprintf(out, "  %03X  %02X         DB   %02X        ; ", addr, byte, byte);
+            for(int bit = 7; bit >= 0; bit--)
+                fputc(byte >> bit & 1 ? '#' : '.', out);
+            fprintf(out, "%s\n", f & DISASM_OPERAND ? " (inside an opcode)" : "");
+            sprite_rows--;
+            addr++;
+            continue;
+        }
+        fprintf(out, "  %03X  DB  ", addr);
+        int n = 0;
+        do {
+            fprintf(out, " %02X", c->MEMORY[addr]);
+            addr++;
+            n++;
+        } while(n < 8 && addr < to && !(cfg->flags[addr] & (DISASM_CODE | DISASM_DATA_REF)));
+        fprintf(out, "\n");
+    }
+}
+
+void chip8_cfg_dot(const chip8_cfg_t *cfg, const chip8_t *c, FILE *out){
+    fprintf(out, "digraph cfg {\n    node [shape=box fontname=monospace fontsize=10];\n");
+    for(int i = 0; i < cfg->num_blocks; i++){
+        const chip8_cfg_block_t *b = &cfg->blocks[i];
+        uint8_t f = cfg->flags[b->start];
+        fprintf(out, "    b%03X [label=\"", b->start);
+        if(f & DISASM_CALL_TARGET)
+            fprintf(out, "sub_%03X\\l", b->start);
+        for(uint32_t addr = b->start; addr < b->end; ){
+            char text[32];
+            int size = chip8_disasm_insn(word_at(c, addr), word_at(c, addr + 2), text, sizeof(text));
+            fprintf(out, "%03X  %s\\l", (unsigned)addr, text);
+            addr += size;
+        }
+        fprintf(out, "\"%s];\n", f & DISASM_INDIRECT ? " style=rounded" : "");
+
+        for(int s = 0; s < b->num_succ; s++){
+            if(chip8_cfg_find(cfg, b->succ[s]) < 0)
+                continue;
+            const char *style = "";
+            if(b->end_kind == CFG_CALL)
+                style = " [label=\"return\" style=dashed]";
+            else if(b->end_kind == CFG_SKIP && s == 1)
+                style = " [label=\"skip\"]";
+            fprintf(out, "    b%03X -> b%03X%s;\n", b->start, b->succ[s], style);
+        }
+        if(b->end_kind == CFG_CALL)
+            fprintf(out, "    b%03X -> b%03X [label=\"call\" color=blue];\n", b->start, b->target);
+        if(b->end_kind == CFG_INDIRECT){
+            // every block BNNN may reach, NNN + 0..255
+            for(int j = chip8_cfg_find(cfg, b->target); j >= 0 && j < cfg->num_blocks && cfg->blocks[j].start <= b->target + 255; j++)
+                if(cfg->flags[cfg->blocks[j].start] & DISASM_INDIRECT)
+                    fprintf(out, "    b%03X -> b%03X [style=dotted];\n", b->start, cfg->blocks[j].start);
+        }
+    }
+    fprintf(out, "}\n");
+}
+
+int chip8_cfg_prewarm(chip8_t *c, const chip8_cfg_t *cfg){
+    chip8_bcache_t *bc = c->bcache;
+    if(bc == NULL)
+        return 0;
+    int built = 0;
+    for(int i = 0; i < cfg->num_blocks; i++){
+        const chip8_cfg_block_t *cb = &cfg->blocks[i];
+        // a cache block also ends at FX0A and the memory writes, cover the CFG block with as many as it takes
+        for(uint32_t pc = cb->start; pc < cb->end; ){
+            if(bc->block_at[pc] == 0){
+                if(bc->num_blocks == BCACHE_MAX_BLOCKS || bc->num_insns + BLOCK_MAX_INSNS > BCACHE_MAX_INSNS)
+                    return built; // building more would flush what is there
+                chip8_block_t *b = bcache_build(c, pc);
+                if(c->jit)
+                    jit_precompile(c, b);
+                built++;
+            }
+            chip8_block_t *b = &bc->blocks[bc->block_at[pc] - 1];
+            const chip8_insn_t *last = &bc->insns[b->first + b->len - 1];
+            pc += 2 * b->len + (last->op == OP_LD_I_LONG ? 2 : 0);
+        }
+    }
+    return built;
+}
+
+int chip8_prewarm(chip8_t *c){
+    if(c->bcache == NULL)
+        return 0;
+    chip8_cfg_t *cfg = malloc(sizeof(chip8_cfg_t));
+    if(cfg == NULL)
+        return 0;
+    int built = chip8_cfg_build(cfg, c) ? chip8_cfg_prewarm(c, cfg) : 0;
+    chip8_cfg_free(cfg);
+    free(cfg);
+    return built;
+}
@@ -0,0 +1,68 @@
+// Static disassembler: recursive descent from the entry point into a control-flow graph of basic blocks
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/* What the descent found out about each byte of MEMORY, in chip8_cfg_t.flags.
+   Bytes neither CODE nor OPERAND were never reached and are taken for data.
+   Self-modifying code and computed jumps other than BNNN jump tables are
+   invisible to a static pass, so "data" means "not provably code". The
+   descent also stops at 0000, empty memory rather than a SYS worth following. */
+#define DISASM_CODE 1 // first byte of a reachable opcode
+#define DISASM_OPERAND 2 // the rest of one: its second byte, or the NNNN word of F000 NNNN
+#define DISASM_LEADER 4 // a basic block starts here
+#define DISASM_JUMP_TARGET 8 // 1NNN or a skip lands here
+#define DISASM_CALL_TARGET 16 // 2NNN enters a subroutine here
+#define DISASM_INDIRECT 32 // BNNN may land here (its base, or an entry of the jump table after it)
+#define DISASM_DATA_REF 64 // ANNN or F000 NNNN points I here
+#define DISASM_OVERLAP 128 // reached in the middle of another opcode
+
+// How a basic block ends, in chip8_cfg_block_t.end_kind
+enum { CFG_FALL, CFG_JUMP, CFG_SKIP, CFG_CALL, CFG_RET, CFG_INDIRECT, CFG_HALT };
+
+typedef struct {
+    uint16_t start, end; // byte range [start, end)
+    uint16_t last; // address of the last opcode
+    uint8_t end_kind; // CFG_*
+    uint8_t num_succ;
+    uint16_t succ[2]; // fall-through first, then the taken skip or jump
+    uint16_t target; // 2NNN subroutine or BNNN base
+} chip8_cfg_block_t;
+
+typedef struct {
+    uint8_t flags[MEM_SIZE]; // DISASM_* per byte
+    chip8_cfg_block_t *blocks; // sorted by start
+    int num_blocks;
+    int code_bytes;
+    int indirect_jumps; // BNNN opcodes, their real targets depend on V0 (or VX)
+    int overlaps;
+} chip8_cfg_t;
+
+/* Disassemble from c->PC and the return addresses on the stack, following
+   jumps, calls, skips and BNNN jump tables, and split what was reached into
+   basic blocks. Needs init_machine() or chip8_restore() to have run once in
+   the process, for the opcode tables. 0 when out of memory. */
+int chip8_cfg_build(chip8_cfg_t *cfg, const chip8_t *c);
+void chip8_cfg_free(chip8_cfg_t *cfg);
+// Index of the block containing `addr`, -1 if none does
+int chip8_cfg_find(const chip8_cfg_t *cfg, uint16_t addr);
+
+// Mnemonic for one opcode; `operand` is the word after it, only read for F000 NNNN. Returns its size in bytes
+int chip8_disasm_insn(uint16_t opcode, uint16_t operand, char *buf, size_t size);
+// Annotated listing of MEMORY[from, to): labels, code, and the data in between with sprite previews
+void chip8_cfg_listing(const chip8_cfg_t *cfg, const chip8_t *c, uint16_t from, uint16_t to, FILE *out);
+// Graphviz digraph of the blocks, one node each with its code
+void chip8_cfg_dot(const chip8_cfg_t *cfg, const chip8_t *c, FILE *out);
+
+/* Decode every reachable block into the block cache (and compile it when the
+   JIT is on) before the first opcode runs, instead of on first execution.
+   Stops short of filling the cache; what is left is decoded on demand as
+   before. Returns the number of cache blocks built, 0 without a block cache. */
+int chip8_cfg_prewarm(chip8_t *c, const chip8_cfg_t *cfg);
+// chip8_cfg_build() + chip8_cfg_prewarm(), for hosts right after loading a ROM or state
+int chip8_prewarm(chip8_t *c);
+
+#endif
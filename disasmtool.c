@@ -0,0 +1,58 @@
+// Static disassembler for ROMs: annotated listing on stdout, control-flow graph as Graphviz
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "disasm.h"
+
+static chip8_t machine;
+static chip8_cfg_t cfg;
+
+int main(int argc, char* argv[]){
+    const char *rom = NULL, *dot_path = NULL;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-dot") == 0 && i + 1 < argc) dot_path = argv[++i];
+        else if(argv[i][0] != '-' && rom == NULL) rom = argv[i];
+        else {
+            rom = NULL;
+            break;
+        }
+    }
+    if(rom == NULL){
+        printf("Usage: %s rom.ch8 [-dot cfg.dot]   listing on stdout, -dot also writes the control-flow graph\n", argv[0]);
+        return 2;
+    }
+
+    // the ROM exactly as the emulator would load it, so addresses and fonts line up
+    FILE *f = fopen(rom, "rb");
+    if(f == NULL){
+        fprintf(stderr, "Error: could not open ROM file '%s'\n", rom);
+        return 1;
+    }
+    static uint8_t data[MEM_SIZE];
+    long size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    init_machine(&machine);
+    if(!load_rom_data(&machine, data, size)){
+        fprintf(stderr, "Error: ROM file '%s' is too large for memory. Size: %ld bytes\n", rom, size);
+        return 1;
+    }
+    if(!chip8_cfg_build(&cfg, &machine)){
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    printf("; %s, %ld bytes\n", rom, size);
+    chip8_cfg_listing(&cfg, &machine, 0x200, 0x200 + size, stdout);
+    if(dot_path){
+        FILE *dot = fopen(dot_path, "w");
+        if(dot == NULL){
+            fprintf(stderr, "Error: could not create '%s'\n", dot_path);
+            return 1;
+        }
+        chip8_cfg_dot(&cfg, &machine, dot);
+        fclose(dot);
+    }
+    chip8_cfg_free(&cfg);
+    return 0;
+}
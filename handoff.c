@@ -0,0 +1,53 @@
+// Lock-free handoff between the frontend's threads, see handoff.h
+#include <string.h>
+#include "handoff.h"
+
+#define FRAME_FRESH 4 // in frames_t.middle: published and not picked up yet
+
+void frames_init(frames_t *f){
+    memset(f, 0, sizeof(*f));
+    f->front = 0;
+    atomic_init(&f->middle, 1); // an empty slot, not FRAME_FRESH
+    f->back = 2;
+}
+
+frame_t *frames_back(frames_t *f){
+    return &f->slots[f->back];
+}
+
+void frames_publish(frames_t *f){
+    // release: the slot's contents are visible before its index is
+    unsigned old = atomic_exchange_explicit(&f->middle, f->back | FRAME_FRESH, memory_order_acq_rel);
+    f->back = old & ~FRAME_FRESH;
+    f->published++;
+}
+
+const frame_t *frames_latest(frames_t *f){
+    if(!(atomic_load_explicit(&f->middle, memory_order_relaxed) & FRAME_FRESH))
+        return NULL;
+    // acquire: pairs with the publish that set FRAME_FRESH
+    unsigned old = atomic_exchange_explicit(&f->middle, f->front, memory_order_acq_rel);
+    f->front = old & ~FRAME_FRESH;
+    f->picked_up++;
+    return &f->slots[f->front];
+}
+
+int inputq_push(inputq_t *q, const input_event_t *ev){
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&q->tail, memory_order_acquire) == INPUT_QUEUE_EVENTS){
+        q->dropped++;
+        return 0;
+    }
+    q->ring[head % INPUT_QUEUE_EVENTS] = *ev;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
+
+int inputq_pop(inputq_t *q, input_event_t *ev){
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if(tail == atomic_load_explicit(&q->head, memory_order_acquire))
+        return 0;
+    *ev = q->ring[tail % INPUT_QUEUE_EVENTS];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
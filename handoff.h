@@ -0,0 +1,70 @@
+// Lock-free handoff between the frontend's threads: finished frames go from emulation to rendering
+// through a triple buffer, input events come back through a single-producer single-consumer queue
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+#define INPUT_QUEUE_EVENTS 256 // a power of two, far more than a frame's worth of key events
+
+// The display as the emulation thread left it at the end of a frame
+typedef struct {
+    uint64_t SCREEN[SCRN_PLANES][SCRN_HIRES_HEIGHT][2];
+    uint8_t hires;
+    uint64_t hash; // chip8_screen_hash()
+    uint32_t frame; // emulated frames since power-on
+    // -latency: a key press this frame is the first visible response to, 0 if none
+    uint64_t key_ns; // host time of the press
+    uint32_t key_frame; // emulated frame it was applied in
+} frame_t;
+
+/* Three slots: the producer fills `back`, the consumer reads `front`, and
+   publishing or picking up a frame swaps the own slot with the one in
+   `middle`. Neither side ever waits; frames the renderer was too slow for are
+   overwritten in the middle slot and never shown. */
+typedef struct {
+    frame_t slots[3];
+    _Alignas(64) _Atomic unsigned middle; // slot index, FRAME_FRESH set while not picked up yet
+    _Alignas(64) unsigned back; // producer-only
+    uint64_t published;
+    _Alignas(64) unsigned front; // consumer-only
+    uint64_t picked_up;
+} frames_t;
+
+void frames_init(frames_t *f);
+// The slot to fill before frames_publish(), the producer's own until then
+frame_t *frames_back(frames_t *f);
+void frames_publish(frames_t *f);
+// The newest published frame if there is one the consumer has not seen, else NULL
+const frame_t *frames_latest(frames_t *f);
+
+enum { INPUT_KEY_DOWN, INPUT_KEY_UP };
+// Frontend functions on keys of their own, each backend picks which (see usage())
+enum { HOTKEY_NONE, HOTKEY_SLOWER, HOTKEY_FASTER, HOTKEY_TURBO, HOTKEY_FAST_FORWARD, HOTKEY_REWIND,
+       HOTKEY_SAVE_STATE, HOTKEY_LOAD_STATE };
+#define INPUT_NO_KEY 0xFF // input_event_t.keypad of a key that is not on the keypad
+
+typedef struct {
+    uint8_t type; // INPUT_*
+    uint8_t repeat; // key held down, sent again by the OS
+    uint8_t keypad; // CHIP-8 key 0-F, or INPUT_NO_KEY
+    uint8_t hotkey; // HOTKEY_*
+    uint64_t time_ns; // host time the OS saw it, sched_now_ns() clock
+} input_event_t;
+
+typedef struct {
+    input_event_t ring[INPUT_QUEUE_EVENTS];
+    // indices only ever grow, each on its own cache line
+    _Alignas(64) _Atomic uint32_t head; // next event the producer writes
+    uint64_t dropped; // producer-only, events lost to a full queue
+    _Alignas(64) _Atomic uint32_t tail; // next event the consumer reads
+} inputq_t;
+
+// 0 when the queue is full, the event is dropped then
+int inputq_push(inputq_t *q, const input_event_t *ev);
+// 0 when the queue is empty
+int inputq_pop(inputq_t *q, input_event_t *ev);
+
+#endif
@@ -0,0 +1,47 @@
+// Key events timed to the opcode, see input.h
+#include "input.h"
+#include "movie.h"
+
+void chip8_input_clear(chip8_input_t *in){
+    in->num = 0;
+}
+
+int chip8_input_add(chip8_input_t *in, const chip8_input_event_t *ev){
+    if(in->num == CHIP8_INPUT_MAX)
+        return 0;
+    int i = in->num++;
+    while(i > 0 && in->events[i - 1].at > ev->at){
+        in->events[i] = in->events[i - 1];
+        i--;
+    }
+    in->events[i] = *ev;
+    return 1;
+}
+
+int chip8_input_run(chip8_t *c, int cycles, chip8_input_t *in, chip8_trace_t *trace){
+    int executed = 0;
+    int pos = 0; // opcodes of the frame that have passed, run or waited through
+    for(int i = 0; i <= in->num; i++){
+        int until = i < in->num && (int)in->events[i].at < cycles ? (int)in->events[i].at : cycles;
+        if(until > pos){
+            executed += trace ? chip8_trace_run(trace, c, until - pos) : chip8_run(c, until - pos);
+            pos = until; // short only when FX0A waits or the machine halted, that time passes all the same
+        }
+        if(i == in->num)
+            break;
+        chip8_input_event_t *ev = &in->events[i];
+        if(ev->down)
+            chip8_key_down(c, ev->key);
+        else
+            chip8_key_up(c, ev->key);
+        ev->applied = c->cycles;
+    }
+    return executed;
+}
+
+int chip8_input_in_sync(const chip8_input_t *in){
+    for(int i = 0; i < in->num; i++)
+        if(in->events[i].cycle != MOVIE_NO_CYCLE && in->events[i].cycle != in->events[i].applied)
+            return 0;
+    return 1;
+}
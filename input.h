@@ -0,0 +1,37 @@
+// Key events timed to the opcode: a frame's keypad changes are collected with their offsets, then the frame runs in pieces between them
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "trace.h"
+
+#define CHIP8_INPUT_MAX 64 // keypad changes in one frame, hosts keep the rest for the next one
+
+typedef struct {
+    uint32_t at; // opcodes into the frame's budget
+    uint8_t key, down;
+    uint64_t cycle; // c->cycles a movie expects it at, MOVIE_NO_CYCLE when unchecked
+    uint64_t host_ns; // when the host saw it, 0 if it did not come from a person
+    uint64_t applied; // set by chip8_input_run(): c->cycles when it took effect
+} chip8_input_event_t;
+
+typedef struct {
+    chip8_input_event_t events[CHIP8_INPUT_MAX]; // in order of `at`
+    int num;
+} chip8_input_t;
+
+void chip8_input_clear(chip8_input_t *in);
+// Insert by `at`, after the events with the same offset (a tap is a down then an up). 0 when full
+int chip8_input_add(chip8_input_t *in, const chip8_input_event_t *ev);
+
+/* Run one frame of `cycles` opcodes and apply each event once `at` opcodes
+   of the frame have passed. Time passes while FX0A waits, so a key press
+   that ends the wait resumes the machine at the offset it was made at, not
+   at the frame's start. With `trace`, opcodes are logged through
+   chip8_trace_run(). Returns the opcodes executed. */
+int chip8_input_run(chip8_t *c, int cycles, chip8_input_t *in, chip8_trace_t *trace);
+// 0 if an event with an expected cycle was applied at another one
+int chip8_input_in_sync(const chip8_input_t *in);
+
+#endif
@@ -0,0 +1,344 @@
+/* One CHIP-8 interpreter, compiled once per quirk profile: chip8.c defines
+   INTERP_NAME and QUIRKS (the profile's CHIP8_QUIRK_* bits, or c->quirks for
+   the generic one) and includes this file, which defines decode_execute_<name>,
+   execute_<name>, cycle_<name> and run_<name>. No include guard on purpose. */
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_SWITCH
+static void INTERP(decode_execute)(chip8_t *c, uint16_t opcode){
+    PROFILE_INSN(c, op_table[opcode >> 12][opcode & 0xff]);
+    /*
+    opcode = 
+               fb      sb
+            ________|________
+            8 bits  | 8 bits
+
+    fb =
+            fs    ss
+            ____|____
+            4-b | 4-b
+
+    sb = 
+            ts    fs
+            ____|____
+            4-b | 4-b
+     */
+    uint8_t fb = (opcode >> 8) & 0xff; //first byte
+    uint8_t fs = (fb >> 4) & 0x0f; //first symbol
+    uint8_t ss = fb & 0x0f; //second symbol
+
+    uint8_t sb = opcode & 0x00ff; //second byte
+    uint8_t ts = (sb >> 4) & 0x0f; // third symbol
+    uint8_t ffs = sb & 0x0f; // fourth symbol
+    // some instructions requires 2-nd, 3-rd and 4-th bytes as address
+    uint16_t nnn = opcode & 0x0fff;
+
+    switch(fs){
+        case 0x0: // CLS or SYS or RET, SUPER-CHIP scrolls and modes
+            if(sb == 0xe0){
+                inst_cls(c);
+            }
+            else if(sb == 0xee){
+                inst_ret(c);
+            }
+            else if(ts == 0xc){
+                inst_scroll_down(c, ffs);
+            }
+            else if(ts == 0xd){
+                inst_scroll_up(c, ffs);
+            }
+            else if(sb == 0xfb){
+                inst_scroll_right(c);
+            }
+            else if(sb == 0xfc){
+                inst_scroll_left(c);
+            }
+            else if(sb == 0xfd){
+                inst_exit(c);
+            }
+            else if(sb == 0xfe || sb == 0xff){
+                inst_set_hires(c, sb == 0xff);
+            }
+            else{
+                // TODO: SYS addr ([0]=ss, [1]=ts, [2]=ffs)
+                // As Cowgos's Technical reference says, this instruction is only used on the old computers and is not supported in modern interpreters, but I will add it for backward compatibility
+                //inst_jp(nnn);
+                c->PC += 2;
+            }
+            break;
+        case 0x1: // JP addr ([0]=ss, [1]=ts, [2] = ffs)
+            inst_jp(c, nnn);
+            break;
+        case 0x2: // CALL addr ([0]=ss, [1,2]=sb)
+            inst_call(c, nnn);
+            break;
+        case 0x3: // SE Vx (x=ss), byte (byte=sb)
+            inst_se(c, ss, sb);
+            break;
+        case 0x4: // SNE Vx (x=ss), byte (byte=sb)
+            inst_sne(c, ss, sb);
+            break;
+        case 0x5:
+            if(ffs == 0x0){ // SE Vx (x=ss), Vy (y=ts)
+                inst_se(c, ss, c->V[ts]);
+            }
+            else if(ffs == 0x2){ // SAVE Vx - Vy
+                inst_store_range(c, ss, ts);
+            }
+            else if(ffs == 0x3){ // LOAD Vx - Vy
+                inst_read_range(c, ss, ts);
+            }
+            else{
+                c->PC += 2; // unknown, skipped
+            }
+            break;
+        case 0x6: // LD Vx (x=ss), byte (byte=sb)
+            inst_ld(c, ss, sb);
+            break;
+        case 0x7: // ADD Vx (xx=ss), byte (byte=sb)
+            inst_add(c, ss, sb);
+            break;
+        case 0x8: 
+            switch(ffs){
+                case 0x0: // LD Vx (x=ss), Vy (y=ts)
+                    inst_ld(c, ss, c->V[ts]);
+                    break;
+                case 0x1: // OR Vx (x=ss), Vy (y=ts)
+                    inst_or_q(c, ss, ts, QUIRKS);
+                    break;
+                case 0x2: // AND Vx, Vy
+                    inst_and_q(c, ss, ts, QUIRKS);
+                    break;
+                case 0x3: // XOR Vx, Vy
+                    inst_xor_q(c, ss, ts, QUIRKS);
+                    break;
+                case 0x4: // ADD Vx, Vy
+                    inst_add_vx_vy(c, ss, ts);
+                    break;
+                case 0x5: // SUB Vx, Vy
+                    inst_sub_vx_vy(c, ss, ts);
+                    break;
+                case 0x6: // SHR Vx, Vy
+                    inst_shr_q(c, ss, ts, QUIRKS);
+                    break;
+                case 0x7: // SUBN Vx, Vy
+                    inst_subn_vx_vy(c, ss, ts);
+                    break;
+                case 0xe: // SHL Vx, Vy
+                    inst_shl_q(c, ss, ts, QUIRKS);
+                    break;
+                default:
+                    c->PC += 2; // unknown, skipped
+                    break;
+            }
+            break;
+        case 0x9: // SNE Vx (x=ss), Vy (y=ts)
+            if(ffs == 0x0){
+                inst_sne(c, ss, c->V[ts]);
+            }
+            else{
+                c->PC += 2; // unknown, skipped
+            }
+            break;
+        case 0xa: // LD I, addr ([0]=ss, [1,2]=sb)
+            inst_ld_addr(c, nnn);
+            break;
+        case 0xb: // JP V0, addr ([0]=ss, [1,2]=sb)
+            inst_jp_v0_q(c, nnn, QUIRKS);
+            break;
+        case 0xc: // RND Vx (x=ss), byte (kk=sb)
+            inst_rnd(c, ss, sb);
+            break;
+        case 0xd: // DRW Vx (x=ss), Vy (y=ts), nibble (nibble=ffs)
+            inst_drw_q(c, ss, ts, ffs, QUIRKS);
+            break;
+        case 0xe:
+            if(sb == 0x9e){
+                // SKP Vx (x=ss)
+                inst_skp(c, ss);
+            }
+            else if (sb == 0xa1){
+                // SKNP Vx (x=ss)
+                inst_sknp(c, ss);
+            }
+            else{
+                c->PC += 2; // unknown, skipped
+            }
+            break;
+        case 0xf:
+            switch(sb){
+                case 0x00: // LD I, long (F000 NNNN)
+                    inst_ld_i_long(c);
+                    break;
+                case 0x01: // PLANE n
+                    inst_plane(c, ss);
+                    break;
+                case 0x02: // AUDIO
+                    inst_audio(c);
+                    break;
+                case 0x07: // LD Vx, DT
+                    inst_ld_dt(c, ss);
+                    break;
+                case 0x0a: // LD Vx, K
+                    inst_ld_k(c, ss);
+                    break;
+                case 0x15: // LD DT, Vx
+                    inst_dt_ld(c, ss);
+                    break;
+                case 0x18: // LD ST, Vx
+                    inst_st_ld(c, ss);
+                    break;
+                case 0x1e: // ADD I, Vx
+                    inst_add_i(c, ss);
+                    break;
+                case 0x29: // LD F, Vx
+                    inst_f_ld(c, ss);
+                    break;
+                case 0x30: // LD HF, Vx
+                    inst_hf_ld(c, ss);
+                    break;
+                case 0x33: // LD B, Vx
+                    inst_bcd_ld(c, ss);
+                    break;
+                case 0x3a: // PITCH Vx
+                    inst_pitch(c, ss);
+                    break;
+                case 0x55: // LD [I], Vx
+                    inst_store_registers_q(c, ss, QUIRKS);
+                    break;
+                case 0x65: // LD Vx, [I]
+                    inst_read_registers_q(c, ss, QUIRKS);
+                    break;
+                case 0x75: // LD R, Vx
+                    inst_store_flags(c, ss);
+                    break;
+                case 0x85: // LD Vx, R
+                    inst_read_flags(c, ss);
+                    break;
+                default:
+                    c->PC += 2; // unknown, skipped
+                    break;
+            }
+            break;
+    }
+}
+
+static void INTERP(execute)(chip8_t *c, const chip8_insn_t *in){
+    PROFILE_INSN(c, in->op);
+    switch(in->op){
+#define X(name, body) case OP_##name: body; break;
+        CHIP8_OPS(X)
+#undef X
+    }
+}
+#else
+#define X(name, body) static void INTERP(op_##name)(chip8_t *c, const chip8_insn_t *in){ (void)in; body; }
+CHIP8_OPS(X)
+#undef X
+
+static const op_handler_t INTERP(handlers)[OP_COUNT] = {
+#define X(name, body) INTERP(op_##name),
+    CHIP8_OPS(X)
+#undef X
+};
+
+static void INTERP(execute)(chip8_t *c, const chip8_insn_t *in){
+    PROFILE_INSN(c, in->op);
+    INTERP(handlers)[in->op](c, in);
+}
+
+static void INTERP(decode_execute)(chip8_t *c, uint16_t opcode){
+    chip8_insn_t in;
+    chip8_decode(opcode, &in);
+    PROFILE_INSN(c, in.op);
+    INTERP(handlers)[in.op](c, &in);
+}
+#endif
+
+static int INTERP(cycle)(chip8_t *c){
+    if(c->halted){
+        return 0;
+    }
+    if(c->waiting_for_key){
+        // Check if a key press has populated key_press_buffer since FX0A was called
+        if (c->key_press_buffer != -1) {
+            c->V[c->key_dest] = c->key_press_buffer; // Store the pressed key's value in Vx
+            c->waiting_for_key = 0;                  // Exit the waiting state
+            c->PC += 2;                              // Advance PC, as the instruction is now complete
+        }
+        return 0;
+    }
+
+    // Fetch the 16-bit opcode from memory (PC points to the first byte)
+    uint16_t opcode = c->MEMORY[c->PC & MEM_MASK] << 8 | c->MEMORY[(c->PC + 1) & MEM_MASK];
+    INTERP(decode_execute)(c, opcode);
+    c->cycles++;
+    return 1;
+}
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO
+static int INTERP(run)(chip8_t *c, int cycles){
+    // Threaded interpreter: every opcode body ends in its own indirect jump to the next one
+    static void *const labels[OP_COUNT] = {
+#define X(name, body) &&do_##name,
+        CHIP8_OPS(X)
+#undef X
+    };
+    chip8_insn_t insn;
+    const chip8_insn_t *in = &insn;
+    int executed = 0, left = 0; // left: opcodes still to run from the current block
+
+    // a pending FX0A is resolved the slow way before entering the threaded loop
+    if(c->waiting_for_key && (INTERP(cycle)(c), c->waiting_for_key))
+        return 0;
+
+refill:
+    // only the last opcode of a block can halt or start waiting for a key
+    if(executed == cycles || c->halted || c->waiting_for_key)
+        return executed;
+    if(c->bcache){
+        chip8_block_t *b = bcache_lookup(c, c->PC);
+        int native = c->jit ? jit_run_block(c, b, cycles - executed) : 0;
+        executed += native;
+        c->cycles += native;
+        // interpret whatever the native code did not cover
+        in = &c->bcache->insns[b->first + native];
+        left = b->len - native < cycles - executed ? b->len - native : cycles - executed;
+        if(left == 0)
+            goto refill;
+    } else {
+        chip8_decode(c->MEMORY[c->PC & MEM_MASK] << 8 | c->MEMORY[(c->PC + 1) & MEM_MASK], &insn);
+        in = &insn;
+        left = 1;
+    }
+    executed += left;
+    c->cycles += left;
+    goto *labels[in->op];
+
+#define X(name, body) do_##name: PROFILE_INSN(c, OP_##name); body; if(--left){ in++; goto *labels[in->op]; } goto refill;
+    CHIP8_OPS(X)
+#undef X
+}
+#else
+static int INTERP(run)(chip8_t *c, int cycles){
+    // Run up to `cycles` opcodes back to back, stopping early on FX0A or a fault
+    int executed = 0;
+    while(executed < cycles && !c->halted){
+        if(c->bcache && !c->waiting_for_key){
+            chip8_block_t *b = bcache_lookup(c, c->PC);
+            int native = c->jit ? jit_run_block(c, b, cycles - executed) : 0;
+            const chip8_insn_t *in = &c->bcache->insns[b->first + native];
+            int n = b->len - native < cycles - executed - native ? b->len - native : cycles - executed - native;
+            for(int i = 0; i < n; i++)
+                INTERP(execute)(c, &in[i]);
+            executed += native + n;
+            c->cycles += native + n;
+        }
+        else if(INTERP(cycle)(c)) executed++;
+        else if(c->waiting_for_key) break; // still no key, nothing left to do this frame
+    }
+    return executed;
+}
+#endif
+
+#undef INTERP_NAME
+#undef QUIRKS
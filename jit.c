@@ -0,0 +1,425 @@
+// x86-64 JIT: compiles hot basic blocks to native code in an mmap'd arena
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(CHIP8_PROFILE)
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* The arena is never writable and executable at once: it stays read+exec,
+   and only the pages a block is emitted into turn read+write for the length
+   of jit_compile(). Emitted code is never patched afterwards. */
+typedef struct chip8_jit {
+    uint8_t *arena;
+    size_t used;
+} chip8_jit_t;
+
+/* Generated code is a plain function taking the chip8_t* in rdi (SysV ABI).
+   Up to JIT_VREGS distinct V registers of a block live in caller-saved host
+   registers from block entry to exit; r11 is scratch. Every cached value is
+   kept zero-extended to 0..255 so byte stores write it back unchanged. */
+#define JIT_VREGS 7
+static const uint8_t vreg_host[JIT_VREGS] = { 0 /*eax*/, 1 /*ecx*/, 2 /*edx*/, 6 /*esi*/, 8, 9, 10 };
+#define SCRATCH 11 // r11
+#define CTX 7 // rdi
+
+// longest block body: 32 ALU opcodes of at most ~35 bytes plus entry/exit code
+#define JIT_MAX_BLOCK_BYTES 2048
+
+typedef struct {
+    uint8_t *p;
+} emitter_t;
+
+static void emit8(emitter_t *e, uint8_t b){ *e->p++ = b; }
+static void emit16(emitter_t *e, uint16_t v){ memcpy(e->p, &v, 2); e->p += 2; }
+static void emit32(emitter_t *e, uint32_t v){ memcpy(e->p, &v, 4); e->p += 4; }
+
+static void emit_rex(emitter_t *e, int w, int reg, int rm, int force){
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if(rex != 0x40 || force)
+        emit8(e, rex);
+}
+
+// op r/m32, r32 (mov 89, add 01, or 09, and 21, sub 29, xor 31, cmp 39)
+static void emit_rr(emitter_t *e, uint8_t op, int dst, int src){
+    emit_rex(e, 0, src, dst, 0);
+    emit8(e, op);
+    emit8(e, 0xc0 | (src & 7) << 3 | (dst & 7));
+}
+
+// group-1 op r/m32, imm32 (add /0, and /4, cmp /7)
+static void emit_ri(emitter_t *e, int ext, int dst, uint32_t imm){
+    emit_rex(e, 0, 0, dst, 0);
+    emit8(e, 0x81);
+    emit8(e, 0xc0 | ext << 3 | (dst & 7));
+    emit32(e, imm);
+}
+
+static void emit_mov_ri(emitter_t *e, int dst, uint32_t imm){
+    emit_rex(e, 0, 0, dst, 0);
+    emit8(e, 0xb8 + (dst & 7));
+    emit32(e, imm);
+}
+
+// shift group r/m32, imm8 (shl /4, shr /5)
+static void emit_shift(emitter_t *e, int ext, int dst, uint8_t count){
+    emit_rex(e, 0, 0, dst, 0);
+    emit8(e, 0xc1);
+    emit8(e, 0xc0 | ext << 3 | (dst & 7));
+    emit8(e, count);
+}
+
+// movzx r32, byte/word [rdi + disp]
+static void emit_load_zx(emitter_t *e, int word, int dst, uint32_t disp){
+    emit_rex(e, 0, dst, CTX, 0);
+    emit8(e, 0x0f);
+    emit8(e, word ? 0xb7 : 0xb6);
+    emit8(e, 0x80 | (dst & 7) << 3 | CTX);
+    emit32(e, disp);
+}
+
+// mov byte [rdi + disp], r8 (REX always, so esi means sil and not dh)
+static void emit_store8(emitter_t *e, int src, uint32_t disp){
+    emit_rex(e, 0, src, CTX, 1);
+    emit8(e, 0x88);
+    emit8(e, 0x80 | (src & 7) << 3 | CTX);
+    emit32(e, disp);
+}
+
+// mov word [rdi + disp], r16
+static void emit_store16(emitter_t *e, int src, uint32_t disp){
+    emit8(e, 0x66);
+    emit_rex(e, 0, src, CTX, 0);
+    emit8(e, 0x89);
+    emit8(e, 0x80 | (src & 7) << 3 | CTX);
+    emit32(e, disp);
+}
+
+// mov word [rdi + disp], imm16
+static void emit_store16_imm(emitter_t *e, uint32_t disp, uint16_t imm){
+    emit8(e, 0x66);
+    emit8(e, 0xc7);
+    emit8(e, 0x80 | CTX);
+    emit32(e, disp);
+    emit16(e, imm);
+}
+
+#define OFF_V(x) (uint32_t)(offsetof(chip8_t, V) + (x))
+#define OFF_PC (uint32_t)offsetof(chip8_t, PC)
+#define OFF_I (uint32_t)offsetof(chip8_t, I)
+
+typedef struct {
+    int8_t host[16]; // host register caching V[x], -1 if V[x] is not used by the block
+    int used;
+} regmap_t;
+
+static int map_reg(regmap_t *m, int x){
+    if(m->host[x] < 0){
+        if(m->used == JIT_VREGS)
+            return 0;
+        m->host[x] = vreg_host[m->used++];
+    }
+    return 1;
+}
+
+// V registers an opcode touches under `quirks`, or 0 if the JIT cannot compile it
+static int insn_regs(const chip8_insn_t *in, int quirks, uint8_t regs[3]){
+    switch(in->op){
+        case OP_SYS: case OP_JP: case OP_LD_I:
+            return -1; // supported, no V registers
+        case OP_LD: case OP_ADD: case OP_SE: case OP_SNE: case OP_ADD_I: case OP_F_LD:
+            regs[0] = in->x;
+            return 1;
+        case OP_OR: case OP_AND: case OP_XOR:
+            regs[0] = in->x;
+            regs[1] = in->y;
+            regs[2] = 0xf;
+            return quirks & CHIP8_QUIRK_VF_RESET ? 3 : 2;
+        case OP_LD_V: case OP_SE_V: case OP_SNE_V:
+            regs[0] = in->x;
+            regs[1] = in->y;
+            return 2;
+        case OP_ADD_V: case OP_SUB: case OP_SUBN:
+            regs[0] = in->x;
+            regs[1] = in->y;
+            regs[2] = 0xf;
+            return 3;
+        case OP_SHR: case OP_SHL:
+            regs[0] = in->x;
+            regs[1] = 0xf;
+            regs[2] = in->y;
+            return quirks & CHIP8_QUIRK_SHIFT_VY ? 3 : 2;
+        default:
+            // DRW, RND, FX0A, the timers, the stack and memory writes stay in the interpreter
+            return 0;
+    }
+}
+
+static void emit_writeback(emitter_t *e, const regmap_t *m){
+    for(int x = 0; x < 16; x++)
+        if(m->host[x] >= 0)
+            emit_store8(e, m->host[x], OFF_V(x));
+}
+
+static void emit_exit(emitter_t *e, const regmap_t *m, uint16_t next_pc){
+    emit_writeback(e, m);
+    emit_store16_imm(e, OFF_PC, next_pc);
+    emit8(e, 0xc3); // ret
+}
+
+// `skip_to` is where a taken skip goes, past a 4-byte F000 NNNN when that comes next
+static void emit_skip(emitter_t *e, const regmap_t *m, const chip8_insn_t *in, uint16_t pc, uint16_t skip_to){
+    int vx = m->host[in->x];
+    emit_writeback(e, m); // before the compare, the stores would not touch the flags anyway
+    if(in->op == OP_SE_V || in->op == OP_SNE_V)
+        emit_rr(e, 0x39, vx, m->host[in->y]);
+    else
+        emit_ri(e, 7, vx, in->kk);
+    // SE skips when equal, SNE when not: jump over the "skip" exit otherwise
+    int skip_if_equal = in->op == OP_SE || in->op == OP_SE_V;
+    emit8(e, skip_if_equal ? 0x75 : 0x74); // jne/je rel8
+    emit8(e, 10); // 66 C7 87 disp32 imm16 + ret
+    emit_store16_imm(e, OFF_PC, skip_to);
+    emit8(e, 0xc3);
+    emit_store16_imm(e, OFF_PC, pc + 2);
+    emit8(e, 0xc3);
+}
+
+// the block's quirks are compiled in, chip8_set_quirks() throws the code away when they change
+static void emit_insn(emitter_t *e, const regmap_t *m, const chip8_insn_t *in, int quirks){
+    int vx = m->host[in->x], vy = m->host[in->y], vf = m->host[0xf];
+    int src = quirks & CHIP8_QUIRK_SHIFT_VY ? vy : vx; // what SHR/SHL shift
+    switch(in->op){
+        case OP_SYS:
+            break;
+        case OP_LD:
+            emit_mov_ri(e, vx, in->kk);
+            break;
+        case OP_ADD:
+            emit_ri(e, 0, vx, in->kk);
+            emit_ri(e, 4, vx, 0xff);
+            break;
+        case OP_LD_V:
+            emit_rr(e, 0x89, vx, vy);
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            emit_rr(e, in->op == OP_OR ? 0x09 : in->op == OP_AND ? 0x21 : 0x31, vx, vy);
+            if(quirks & CHIP8_QUIRK_VF_RESET)
+                emit_mov_ri(e, vf, 0);
+            break;
+        case OP_ADD_V: // Vx = low byte of the sum, then VF = carry
+            emit_rr(e, 0x89, SCRATCH, vx);
+            emit_rr(e, 0x01, SCRATCH, vy);
+            emit_rr(e, 0x89, vx, SCRATCH);
+            emit_ri(e, 4, vx, 0xff);
+            emit_shift(e, 5, SCRATCH, 8);
+            emit_rr(e, 0x89, vf, SCRATCH);
+            break;
+        case OP_SUB: // VF = Vx > Vy first, then Vx -= Vy, same order as inst_sub_vx_vy
+            emit_rr(e, 0x89, SCRATCH, vy);
+            emit_rr(e, 0x29, SCRATCH, vx);
+            emit_shift(e, 5, SCRATCH, 31);
+            emit_rr(e, 0x89, vf, SCRATCH);
+            emit_rr(e, 0x29, vx, vy);
+            emit_ri(e, 4, vx, 0xff);
+            break;
+        case OP_SUBN: // VF = Vx < Vy first, then Vx = Vy - Vx
+            emit_rr(e, 0x89, SCRATCH, vx);
+            emit_rr(e, 0x29, SCRATCH, vy);
+            emit_shift(e, 5, SCRATCH, 31);
+            emit_rr(e, 0x89, vf, SCRATCH);
+            emit_rr(e, 0x89, SCRATCH, vy);
+            emit_rr(e, 0x29, SCRATCH, vx);
+            emit_ri(e, 4, SCRATCH, 0xff);
+            emit_rr(e, 0x89, vx, SCRATCH);
+            break;
+        case OP_SHR: // VF = low bit of the source, then Vx = source >> 1, reading the source after VF changed
+            emit_rr(e, 0x89, SCRATCH, src);
+            emit_ri(e, 4, SCRATCH, 1);
+            emit_rr(e, 0x89, vf, SCRATCH);
+            if(vx != src)
+                emit_rr(e, 0x89, vx, src);
+            emit_shift(e, 5, vx, 1);
+            break;
+        case OP_SHL:
+            emit_rr(e, 0x89, SCRATCH, src);
+            emit_shift(e, 5, SCRATCH, 7);
+            emit_rr(e, 0x89, vf, SCRATCH);
+            if(vx != src)
+                emit_rr(e, 0x89, vx, src);
+            emit_shift(e, 4, vx, 1);
+            emit_ri(e, 4, vx, 0xff);
+            break;
+        case OP_LD_I:
+            emit_store16_imm(e, OFF_I, in->nnn);
+            break;
+        case OP_ADD_I:
+            emit_load_zx(e, 1, SCRATCH, OFF_I);
+            emit_rr(e, 0x01, SCRATCH, vx);
+            emit_store16(e, SCRATCH, OFF_I);
+            break;
+        case OP_F_LD: // I = Vx * 5 (imul r11d, vx, 5)
+            emit_rex(e, 0, SCRATCH, vx, 0);
+            emit8(e, 0x6b);
+            emit8(e, 0xc0 | (SCRATCH & 7) << 3 | (vx & 7));
+            emit8(e, 5);
+            emit_store16(e, SCRATCH, OFF_I);
+            break;
+    }
+}
+
+void jit_compile(chip8_t *c, chip8_block_t *b){
+    chip8_jit_t *j = c->jit;
+    const chip8_insn_t *insns = &c->bcache->insns[b->first];
+
+    // longest prefix the JIT supports whose V registers all fit in host registers
+    regmap_t m;
+    memset(m.host, -1, sizeof(m.host));
+    m.used = 0;
+    int n = 0;
+    while(n < b->len){
+        uint8_t regs[3];
+        int count = insn_regs(&insns[n], c->quirks, regs);
+        if(count == 0)
+            break;
+        regmap_t saved = m;
+        int fits = 1;
+        for(int r = 0; r < count; r++)
+            fits &= map_reg(&m, regs[r]);
+        if(!fits){
+            m = saved;
+            break;
+        }
+        n++;
+    }
+    if(n < 2) // not worth a call
+        return;
+
+    if(j->used + JIT_MAX_BLOCK_BYTES > JIT_ARENA_SIZE){
+        bcache_flush(c); // resets the arena too; the block gets compiled again once it is hot
+        return;
+    }
+
+    // open the pages the block may take for writing, none of them runs until they are closed again
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = j->used & ~(page - 1);
+    size_t last = (j->used + JIT_MAX_BLOCK_BYTES + page - 1) & ~(page - 1);
+    if(last > JIT_ARENA_SIZE)
+        last = JIT_ARENA_SIZE;
+    if(mprotect(j->arena + first, last - first, PROT_READ | PROT_WRITE) != 0)
+        return; // stays interpreted
+
+    emitter_t e = { j->arena + j->used };
+    uint8_t *start = e.p;
+    for(int x = 0; x < 16; x++)
+        if(m.host[x] >= 0)
+            emit_load_zx(&e, 0, m.host[x], OFF_V(x));
+
+    uint16_t pc = b->start;
+    for(int i = 0; i < n; i++, pc += 2){
+        const chip8_insn_t *in = &insns[i];
+        switch(in->op){
+            case OP_JP:
+                emit_exit(&e, &m, in->nnn);
+                break;
+            case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V: {
+                // the block cache watches the word after the block, so this stays valid
+                int long_op = c->MEMORY[(pc + 2) & MEM_MASK] == 0xf0 && c->MEMORY[(pc + 3) & MEM_MASK] == 0x00;
+                emit_skip(&e, &m, in, pc, pc + (long_op ? 6 : 4));
+                break;
+            }
+            default:
+                emit_insn(&e, &m, in, c->quirks);
+                if(i == n - 1)
+                    emit_exit(&e, &m, pc + 2);
+                break;
+        }
+    }
+
+    if(mprotect(j->arena + first, last - first, PROT_READ | PROT_EXEC) != 0)
+        return; // the pages stay non-executable, and so does this block
+
+    j->used += e.p - start;
+    j->used = (j->used + 15) & ~(size_t)15;
+    b->jit_len = n;
+    b->code = start;
+}
+
+void jit_precompile(chip8_t *c, chip8_block_t *b){
+    if(c->jit->used + JIT_MAX_BLOCK_BYTES > JIT_ARENA_SIZE)
+        return;
+    b->hits = JIT_HOT + 1; // compiled once, whether or not any code came out
+    jit_compile(c, b);
+}
+
+int chip8_jit_enable(chip8_t *c){
+    if(c->jit)
+        return 1;
+    if(!chip8_bcache_enable(c)) // the JIT compiles blocks found by the block cache
+        return 0;
+    chip8_jit_t *j = malloc(sizeof(chip8_jit_t));
+    if(j == NULL)
+        return 0;
+    // turned read+exec straight away, so a kernel that refuses executable anonymous memory (SELinux
+    // execmem, PaX MPROTECT) leaves the machine on the block cache rather than failing later
+    j->arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(j->arena == MAP_FAILED){
+        free(j);
+        return 0;
+    }
+    if(mprotect(j->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0){
+        munmap(j->arena, JIT_ARENA_SIZE);
+        free(j);
+        return 0;
+    }
+    j->used = 0;
+    c->jit = j;
+    bcache_flush(c); // start counting hits from scratch
+    return 1;
+}
+
+void chip8_jit_disable(chip8_t *c){
+    chip8_jit_t *j = c->jit;
+    if(j == NULL)
+        return;
+    c->jit = NULL;
+    bcache_flush(c); // drop pointers into the arena
+    munmap(j->arena, JIT_ARENA_SIZE);
+    free(j);
+}
+
+void jit_flush(chip8_t *c){
+    if(c->jit)
+        c->jit->used = 0;
+}
+
+#else
+// no JIT on this architecture (or in profiling builds), the interpreter runs everything
+
+int chip8_jit_enable(chip8_t *c){
+    (void)c;
+    return 0;
+}
+
+void chip8_jit_disable(chip8_t *c){
+    (void)c;
+}
+
+void jit_compile(chip8_t *c, chip8_block_t *b){
+    (void)c;
+    (void)b;
+}
+
+void jit_precompile(chip8_t *c, chip8_block_t *b){
+    (void)c;
+    (void)b;
+}
+
+void jit_flush(chip8_t *c){
+    (void)c;
+}
+#endif
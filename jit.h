@@ -0,0 +1,42 @@
+// x86-64 JIT for hot basic blocks, private to the interpreter core
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "bcache.h"
+
+#define JIT_HOT 32 // block entries before it is compiled
+#define JIT_ARENA_SIZE (1 << 20) // the whole block cache is flushed when this fills up
+
+typedef void (*jit_fn_t)(chip8_t *c);
+
+void jit_compile(chip8_t *c, chip8_block_t *b);
+// Compile `b` ahead of its first run if the arena has room, never flushing; it then counts as hot
+void jit_precompile(chip8_t *c, chip8_block_t *b);
+void jit_flush(chip8_t *c);
+
+/* Runs the compiled prefix of `b` natively if it fits in `budget` opcodes and
+   returns how many opcodes it executed, 0 if the block has to be interpreted.
+   If compiling flushed the cache, `b` stays readable until the next block is
+   built, which is all the caller needs to finish interpreting it. */
+static inline int jit_run_block(chip8_t *c, chip8_block_t *b, int budget){
+    if(b->code == NULL){
+        if(b->hits < JIT_HOT){
+            b->hits++;
+            return 0;
+        }
+        if(b->hits > JIT_HOT) // compiled once already and nothing came out of it
+            return 0;
+        b->hits++;
+        jit_compile(c, b);
+        if(b->code == NULL)
+            return 0;
+    }
+    if(b->jit_len > budget)
+        return 0;
+    ((jit_fn_t)b->code)(c);
+    return b->jit_len;
+}
+
+#endif
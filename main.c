@@ -1,911 +1,693 @@
 // CHIP-8 interpreter
 #include <stdlib.h>
-#include <time.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_audio.h>
-#include <math.h>
-
-#define SAMPLE_RATE 44100
-#define AMPLITUDE 28000
-#define FREQUENCY 440
-#define NUM_SAMPLES 2048
-
-#define MEM_SIZE 4096
-#define STCK_SIZE 16
-#define SCRN_SIZE 64*32
-
-
-
-// SDL globals
-SDL_Window* sdlWindow = NULL;
-SDL_Renderer* sdlRenderer = NULL;
-SDL_Texture* sdlTexture = NULL;
-
-// Mapping SDL scancodes to CHIP-8 keys (adjust as needed for your desired layout)
-uint8_t sdl_key_map[SDL_NUM_SCANCODES]; // Max number of scancodes
-
-// hidden registers
-int waiting_for_key = 0, key_dest = 0;
-int draw_screen_flag = 0; // 1 when DRW called
-int key_press_buffer = -1;     // Stores the value of the *single* key just pressed for FX0A, -1 if none
-static int audio_playing = 0; // 1 is on
-
-// common-use registers
-uint8_t V[16]; //V[0]-V[0xF]
-uint8_t DT, ST; // delay timer and song timer
-uint16_t PC, I; // instruction pointer and memory register
-uint8_t SP; // stack pointer
-
-uint8_t MEMORY[MEM_SIZE];
-uint16_t STACK[STCK_SIZE]; // stack
-uint8_t SCREEN[SCRN_SIZE]; // screen
-uint8_t KEYBOARD[16]; 
-
-const uint8_t fontset[80] = {
-  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-  0x20, 0x60, 0x20, 0x20, 0x70, // 1
-  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-int load_rom(const char* filename){
-    // load the rom from real file into MEMORY
-    FILE *rom_file = fopen(filename, "rb");
-    if(rom_file == NULL){
-        printf("Error: could not open ROM file '%s'\n", filename);
-        return 0;
-    }
-
-    /*here we get file size*/
-    fseek(rom_file, 0, SEEK_END);
-    long rom_size = ftell(rom_file);
-    rewind(rom_file); // go to beggining
-
-    /*check if rom is suitable for memory*/
-    if(rom_size > (MEM_SIZE - 0x200)){
-        printf("Error: ROM file '$s' is too large for memory. Size: $ld bytes\n", filename, rom_size);
-        fclose(rom_file);
-        return 0;
-    }
-    
-    /*read rom into memory*/
-    size_t bytes_read = fread(&MEMORY[0x200], 1, rom_size, rom_file);
-    if(bytes_read != rom_size){
-        printf("Warning: Mismatch in bytes read for ROM '%s'. Expected %ld, got %zu\n", filename, rom_size, bytes_read);
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "sched.h"
+#include "audio.h"
+#include "backend.h"
+#include "rewind.h"
+#include "movie.h"
+#include "trace.h"
+#include "quirks.h"
+#include "disasm.h"
+#include "handoff.h"
+#include "input.h"
+#include "snapshot.h"
+#include "capture.h"
+
+#define DEFAULT_IPF 10 // CHIP-8 instructions per 60 Hz frame
+#define SCHIP_IPF 30 // raised to once a ROM uses SUPER-CHIP opcodes, unless -ipf was given
+#define XOCHIP_IPF 1000 // the same for XO-CHIP, the speed Octo runs them at
+#define MAX_IPF 100000
+#define FAST_FORWARD_FRAMES 8 // emulated frames per host frame while the fast-forward key is held
+#define DEFAULT_REWIND_MB 4 // history for the rewind key, ~10 minutes for typical ROMs
+#define MAX_CATCH_UP 4 // frames run back to back after a stall, the rest of the backlog is dropped
+#define RENDER_WAIT_MS 100 // the render thread sleeps on window events, new frames wake it earlier
+#define LATENCY_TIMEOUT_FRAMES 60 // -latency: a key press with no visible response after this long is not counted
+
+
+
+// the machine driven by this frontend
+static chip8_t chip8;
+static const backend_t *backend; // display, audio and keys, -backend
+
+/* Two threads: the main thread owns the backend, polls it for input and
+   presents, so a slow present or a vsync wait stalls only itself. The
+   emulation thread owns the machine and everything below and runs the 60 Hz
+   clock; of the backend it only calls audio_gate() and wake().
+   Frames go one way through `frames`, key events the other way through
+   `input`. */
+static frames_t frames;
+static inputq_t input;
+static atomic_int quit_requested; // window closed, set by the main thread
+static atomic_int emulation_done; // the emulation thread returned
+static sched_t sched; // 60 Hz frame clock
+
+// keypad changes waiting for the emulated frame their host time falls in, emulation thread only
+static chip8_input_event_t pending_keys[INPUT_QUEUE_EVENTS];
+static int num_pending_keys;
+
+/* -latency: host time from a key press to the present of the first frame
+   that differs from the one before it. The emulation thread picks the press
+   and the frame, the render thread times the present and acknowledges it,
+   until then every published frame carries the same press. */
+static int latency_mode;
+static uint64_t latency_press_ns; // 0 when no press is waiting for a response
+static uint32_t latency_press_frame;
+static uint64_t latency_press_hash; // the display before the press
+static uint64_t latency_response_ns; // press with a response, sent until acknowledged
+static uint32_t latency_response_frame;
+static _Atomic uint64_t latency_acked_ns;
+static uint64_t latency_count, latency_unanswered; // render thread, except unanswered
+static double latency_sum_ms, latency_min_ms, latency_max_ms;
+
+// speed settings, changed from the command line and hotkeys
+static int ipf = DEFAULT_IPF; // instructions per frame
+static int ipf_fixed = 0; // -ipf or a movie chose the speed, extensions do not raise it
+static uint8_t speed_extensions = 0; // chip8.extensions the speed was last chosen for
+static int turbo = 0; // 1: run emulated frames back to back, presenting once per host frame
+static int fast_forward = 0; // 1 while the fast-forward key is held
+static int rewinding = 0; // 1 while the rewind key is held
+static chip8_rewind_t *rewind_history; // NULL when rewind is disabled
+static chip8_trace_t *trace; // every executed opcode goes here with -d / -trace
+static capture_t *capture; // -capture: every published frame that changed goes here
+static int runahead = 0; // frames run ahead of the machine for the display, see present_ahead()
+static chip8_snapshot_t ahead_snapshot;
+static uint64_t launched_ns, first_frame_ns; // -stats: the time to the first published frame
+static uint64_t ahead_count, ahead_ns; // -stats: snapshots taken and restored, and the time spent on it
+
+// input movie being recorded or played back
+static chip8_movie_t movie;
+static int recording = 0, playing = 0;
+static const char *record_path;
+static int movie_next = 0; // next event to play
+static uint32_t frame = 0; // emulated frames run since power-on, movies are timed by it
+
+static char quick_state[4096]; // F5/F9 save state, the ROM path with .c8s appended
+
+
+// Emulation thread: hand the display to the render thread, which picks up the newest frame it finds
+static void publish_frame(chip8_t *c, uint32_t number) {
+    frame_t *f = frames_back(&frames);
+    memcpy(f->SCREEN, c->SCREEN, sizeof(f->SCREEN));
+    f->hires = c->hires;
+    f->hash = chip8_screen_hash(c);
+    f->frame = number;
+    if(latency_press_ns && f->hash != latency_press_hash){
+        latency_response_ns = latency_press_ns;
+        latency_response_frame = latency_press_frame;
+        latency_press_ns = 0;
+    }
+    int unacked = latency_response_ns && latency_response_ns != atomic_load(&latency_acked_ns);
+    f->key_ns = unacked ? latency_response_ns : 0;
+    f->key_frame = latency_response_frame;
+    if(capture)
+        capture_frame(capture, f);
+    frames_publish(&frames);
+    if(first_frame_ns == 0)
+        first_frame_ns = sched_now_ns();
+    c->draw_screen_flag = 0;
+
+    backend->wake();
+}
+
+// Render thread: time the press a just-presented frame answers, once per press
+static void report_latency(const frame_t *f) {
+    if(f->key_ns == 0 || f->key_ns == atomic_load(&latency_acked_ns))
+        return;
+    atomic_store(&latency_acked_ns, f->key_ns);
+    double ms = (sched_now_ns() - f->key_ns) / 1e6;
+    printf("latency: %.1f ms, %.2f frames (%u emulated)\n", ms, ms * 60 / 1000, f->frame - f->key_frame);
+    if(latency_count == 0 || ms < latency_min_ms) latency_min_ms = ms;
+    if(ms > latency_max_ms) latency_max_ms = ms;
+    latency_sum_ms += ms;
+    latency_count++;
+}
+
+// Keypad changes from the keyboard wait for their frame, see take_keys(); ignored while a movie plays
+static void set_key(uint8_t key, int down, uint64_t time_ns) {
+    if (playing || num_pending_keys == INPUT_QUEUE_EVENTS)
+        return;
+    chip8_input_event_t ev = { 0, key, down != 0, MOVIE_NO_CYCLE, time_ns, 0 };
+    pending_keys[num_pending_keys++] = ev;
+}
+
+/* Move the keys pressed or released before `end_ns` into `in`, each at the
+   opcode its host time falls on when the frame's budget is spread over
+   [start_ns, end_ns). Keys come in time order, so those left are the newest.
+   end_ns 0 takes them all at the frame's start, for turbo frames that stand
+   for no particular host time. */
+static void take_keys(chip8_input_t *in, uint64_t start_ns, uint64_t end_ns) {
+    int taken = 0;
+    while (taken < num_pending_keys) {
+        chip8_input_event_t ev = pending_keys[taken];
+        if (end_ns && ev.host_ns >= end_ns)
+            break;
+        if (end_ns && ev.host_ns > start_ns)
+            ev.at = (ev.host_ns - start_ns) * ipf / (end_ns - start_ns);
+        if (!chip8_input_add(in, &ev))
+            break;
+        taken++;
     }
-
-    fclose(rom_file);
-    printf("Successfully loaded ROM '%s' (%ld bytes)\n", filename, rom_size);
-    return 1; 
-
+    num_pending_keys -= taken;
+    memmove(pending_keys, pending_keys + taken, num_pending_keys * sizeof(pending_keys[0]));
 }
 
-
-void audio_callback(void* userdata, Uint8* stream, int len) {
-    // Cast the stream to a signed 16-bit integer array
-    Sint16* audio_stream = (Sint16*)stream;
-    static double phase = 0; // Keep track of the phase for continuous sine wave
-
-    // Calculate how many samples to generate
-    int num_samples_to_generate = len / sizeof(Sint16);
-
-    for (int i = 0; i < num_samples_to_generate; ++i) {
-        if (audio_playing) {
-            // Generate a sine wave sample
-            audio_stream[i] = (Sint16)(AMPLITUDE * sin(phase * 2 * M_PI));
-            // Increment phase based on frequency and sample rate
-            phase += (double)FREQUENCY / SAMPLE_RATE;
-            // Wrap phase around 1.0 to keep it within [0, 1)
-            if (phase >= 1.0) {
-                phase -= 1.0;
-            }
-        } else {
-            // If not playing, fill with silence
-            audio_stream[i] = 0;
-        }
-    }
+static void set_ipf(chip8_t *c, int new_ipf) {
+    if (playing)
+        return; // the movie sets the speed
+    ipf = new_ipf;
+    if (recording)
+        chip8_movie_ipf(&movie, frame, c, ipf);
+    printf("IPF: %d\n", ipf);
 }
 
-
-void init_machine(void)
-{
-    /*Init all variables and memory*/
-    PC = 0x200;
-    SP = 0;
-    I = 0;
-    DT = 0;
-    ST = 0;
-    
-    for(int i = 0; i < 80; i++) MEMORY[i] = fontset[i]; // load fonts into memory
-    for(int i = 80; i < MEM_SIZE; i++) MEMORY[i] = 0;
-    for(int i = 0; i < 16; i++) {
-        // initialize V and keyboard in one loop because they have same size
-        V[i] = 0;
-        KEYBOARD[i] = 0;
-    }
-    for(int i = 0; i < SCRN_SIZE; i++) SCREEN[i] = 0; //black screen
-    for(int i = 0; i < STCK_SIZE; i++) STACK[i] = 0;
-
-    srand(time(NULL));
-
-    // Init SDL
-    if(SDL_Init(SDL_INIT_EVERYTHING) < 0){
-        printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
-        exit(1);
-    }
-
-    // Create window
-    sdlWindow = SDL_CreateWindow("CHIP-8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                                 640, 320, SDL_WINDOW_SHOWN); // 10x scale
-    if (sdlWindow == NULL) {
-        printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
-        exit(1);
-    }
-
-    // Create renderer
-    sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED);
-    if (sdlRenderer == NULL) {
-        printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
-        exit(1);
-    }
-
-    // Create texture for the screen (format is ARGB8888 for easier pixel manipulation)
-    sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_ARGB8888,
-                                   SDL_TEXTUREACCESS_STREAMING, 64, 32);
-    if (sdlTexture == NULL) {
-        printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
-        exit(1);
-    }
-
-    // Clear renderer
-    SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 255); // Black background
-    SDL_RenderClear(sdlRenderer);
-    SDL_RenderPresent(sdlRenderer);
+static void stop_recording(void) {
+    movie.frames = frame;
+    if (chip8_movie_save(&movie, record_path))
+        printf("Movie of %u frames saved to %s\n", frame, record_path);
+    recording = 0;
 }
 
-void draw_graphics() {
-    // Create a pixel buffer for SDL Texture
-    uint32_t pixels[SCRN_SIZE]; // ARGB8888 format (32 bits per pixel)
-
-    for (int i = 0; i < SCRN_SIZE; i++) {
-        // If pixel is on (1), make it white; otherwise, black.
-        // ARGB8888: 0xAARRGGBB
-        pixels[i] = SCREEN[i] ? 0xFFFFFFFF : 0xFF000000; // White: 0xFFFFFFFF, Black: 0xFF000000 (opaque alpha)
-    }
+// Emulation thread: apply the keys queued by the backend's poll_input(), hotkeys included
+static void handle_input(chip8_t *c) {
+    input_event_t event;
+    while (inputq_pop(&input, &event)) {
+        if (event.type == INPUT_KEY_DOWN) {
+            // Hotkeys, on whichever keys the backend puts them
+            switch (event.hotkey) {
+                case HOTKEY_SLOWER:
+                    if (ipf > 1) set_ipf(c, ipf / 2);
+                    break;
+                case HOTKEY_FASTER:
+                    if (ipf * 2 <= MAX_IPF) set_ipf(c, ipf * 2);
+                    break;
+                case HOTKEY_TURBO:
+                    if (!event.repeat) {
+                        turbo = !turbo;
+                        printf("Turbo: %s\n", turbo ? "on" : "off");
+                    }
+                    break;
+                case HOTKEY_FAST_FORWARD:
+                    fast_forward = 1;
+                    break;
+                case HOTKEY_REWIND:
+                    rewinding = 1;
+                    break;
+                case HOTKEY_SAVE_STATE:
+                    if (!event.repeat && chip8_save_state(c, quick_state))
+                        printf("Saved state to %s\n", quick_state);
+                    break;
+                case HOTKEY_LOAD_STATE:
+                    if (event.repeat || playing)
+                        break;
+                    if (chip8_load_state(c, quick_state)) {
+                        printf("Loaded state from %s\n", quick_state);
+                        chip8_prewarm(c);
+                        if (recording)
+                            stop_recording(); // the movie cannot follow a jump to another state
+                    }
+                    break;
+                default:
+                    break;
+            }
 
-    // Update the SDL texture with the pixel data
-    SDL_UpdateTexture(sdlTexture, NULL, pixels, 64 * sizeof(uint32_t));
+            if (event.keypad != INPUT_NO_KEY) { // If it's a mapped key
+                set_key(event.keypad, 1, event.time_ns);
+            }
+        }
 
-    // Clear the renderer
-    SDL_RenderClear(sdlRenderer);
-    // Copy the texture to the renderer (scales it to fit the window)
-    SDL_RenderCopy(sdlRenderer, sdlTexture, NULL, NULL);
-    // Present the renderer
-    SDL_RenderPresent(sdlRenderer);
-}
+        if (event.type == INPUT_KEY_UP) {
+            if (event.hotkey == HOTKEY_FAST_FORWARD)
+                fast_forward = 0;
+            if (event.hotkey == HOTKEY_REWIND)
+                rewinding = 0;
 
-void setup_key_map() {
-    // Initialize all to 0xFF (invalid key)
-    for (int i = 0; i < SDL_NUM_SCANCODES; ++i) {
-        sdl_key_map[i] = 0xFF;
+            if (event.keypad != INPUT_NO_KEY) { // If it's a mapped key
+                set_key(event.keypad, 0, event.time_ns);
+            }
+        }
     }
-
-    // Map common keyboard keys to CHIP-8 hex keypad
-    // CHIP-8 Layout:
-    // 1 2 3 C
-    // 4 5 6 D
-    // 7 8 9 E
-    // A 0 B F
-
-    // My suggested mapping (can be customized):
-    // 1 2 3 4
-    // Q W E R
-    // A S D F
-    // Z X C V
-
-    sdl_key_map[SDL_SCANCODE_1] = 0x1;
-    sdl_key_map[SDL_SCANCODE_2] = 0x2;
-    sdl_key_map[SDL_SCANCODE_3] = 0x3;
-    sdl_key_map[SDL_SCANCODE_4] = 0xC; // C
-
-    sdl_key_map[SDL_SCANCODE_Q] = 0x4;
-    sdl_key_map[SDL_SCANCODE_W] = 0x5;
-    sdl_key_map[SDL_SCANCODE_E] = 0x6;
-    sdl_key_map[SDL_SCANCODE_R] = 0xD; // D
-
-    sdl_key_map[SDL_SCANCODE_A] = 0x7;
-    sdl_key_map[SDL_SCANCODE_S] = 0x8;
-    sdl_key_map[SDL_SCANCODE_D] = 0x9;
-    sdl_key_map[SDL_SCANCODE_F] = 0xE; // E
-
-    sdl_key_map[SDL_SCANCODE_Z] = 0xA; // A
-    sdl_key_map[SDL_SCANCODE_X] = 0x0;
-    sdl_key_map[SDL_SCANCODE_C] = 0xB; // B
-    sdl_key_map[SDL_SCANCODE_V] = 0xF; // F
 }
 
-void error_out_of_stack(){
-    printf("SP is out of stack! Export memory dump to out_of_stack.hex\n");
-    // here we should write all registers and stack to memory
-    // and export dump file
-
-    // First, we don't need  first 512 bytes because it only contains sprites,
-    // so we could use it for debug information
-    for(int i = 0; i < 0x200; i++) 
-        MEMORY[i] = 0; // clear first 512 bytes
-
-    /* Here's scheme:
-       address | register
-       ------------------
-         0x0   |    V0
-         0x1   |    V1
-         0x2   |    V2
-         0x3   |    V3
-         0x4   |    V4
-         0x5   |    V5
-         0x6   |    V6
-         0x7   |    V7
-         0x8   |    V8
-         0x9   |    V9
-         0xA   |    VA
-         0xB   |    VB
-         0xC   |    VC
-         0xD   |    VD
-         0xE   |    VE
-         0xF   |    VF
-         0x10  |    DT
-         0x11  |    ST
-         0x12  |    SP
-         0x13  |    PC (2 bytes long)
-         0x15  |    I  (2 bytes long)
-
-         Stack is located from 0x17 to 0x36
-         Keyboard is located from 0x37 to 0x46
-    */
-    for(int i=0; i < 0xf; i++)
-        MEMORY[i] = V[i]; // writing V0-VF
-    MEMORY[0x10] = DT;
-    MEMORY[0x11] = ST;
-    MEMORY[0x12] = SP;
-    MEMORY[0x13] = (PC >> 8) & 0xff;
-    MEMORY[0x14] = PC & 0xff;
-    MEMORY[0x15] = (I >> 8) & 0xff;
-    MEMORY[0x16] = I & 0xff;
-
-    for(int i = 0x17; i < 0x37; i++)
-        MEMORY[i] = STACK[i - 0x17];
-
-    for(int i = 0x37; i < 0x46; i++)
-        MEMORY[i] = KEYBOARD[i - 0x37];
-
-    // write to file
-    FILE *dump_file = fopen("out_of_stack.hex", "wb");
-    if (dump_file == NULL) {
-        perror("Error opening dump file"); // Prints a system error message
-    } else {
-        fwrite(MEMORY, sizeof(uint8_t), MEM_SIZE, dump_file);
-        fclose(dump_file);
-        printf("Memory dump exported to out_of_stack.hex\n");
-    }
-    exit(1); // Terminate the program after dumping
-}
 
-int handle_input() {
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        if (event.type == SDL_QUIT) {
-            return 0; // Signal to quit the emulator
+// Run one 60 Hz frame of emulated time: the IPF budget in one go, then the timers
+static void emulate_frame(chip8_t *c, uint64_t start_ns, uint64_t end_ns){
+    // this frame's keypad changes, from the movie or from the keys made during [start_ns, end_ns)
+    chip8_input_t keys;
+    chip8_input_clear(&keys);
+    int replaying = playing, in_sync = 1;
+    if(playing){
+        in_sync = chip8_movie_input(&movie, &movie_next, frame, c, &ipf, &keys);
+        if(frame >= movie.frames && movie_next == movie.num_events){
+            printf("Movie finished at frame %u, keyboard control is back\n", frame);
+            playing = 0;
         }
-
-        if (event.type == SDL_KEYDOWN) {
-            uint8_t chip8_key = sdl_key_map[event.key.keysym.scancode];
-            if (chip8_key != 0xFF) { // If it's a mapped key
-                KEYBOARD[chip8_key] = 1;
-
-                // If we are waiting for a key (due to FX0A)
-                // AND the key_press_buffer is currently empty (-1 means no key recorded yet)
-                // THEN record this new key press.
-                if (waiting_for_key && key_press_buffer == -1) {
-                    key_press_buffer = chip8_key;
-                }
+    } else
+        take_keys(&keys, start_ns, end_ns);
+
+    if(latency_mode && latency_press_ns == 0){
+        for(int i = 0; i < keys.num && latency_press_ns == 0; i++){
+            if(keys.events[i].down && keys.events[i].host_ns){
+                latency_press_ns = keys.events[i].host_ns;
+                latency_press_frame = frame;
+                latency_press_hash = chip8_screen_hash(c);
             }
         }
+    }
 
-        if (event.type == SDL_KEYUP) {
-            uint8_t chip8_key = sdl_key_map[event.key.keysym.scancode];
-            if (chip8_key != 0xFF) { // If it's a mapped key
-                KEYBOARD[chip8_key] = 0;
-
-                // If the key that was just released is the one currently stored
-                // in the key_press_buffer, then clear the buffer.
-                // This ensures that the *next* FX0A will wait for a new press.
-                if (key_press_buffer == chip8_key) {
-                    key_press_buffer = -1;
-                }
+    // the budget in pieces between the key changes, returns early while FX0A waits for a key
+    chip8_input_run(c, ipf, &keys, trace); // with a trace, single-steps and logs every opcode
+    if(replaying && !(in_sync && chip8_input_in_sync(&keys))){
+        static int desync_reported = 0;
+        if(!desync_reported)
+            printf("Movie desynced at frame %u\n", frame);
+        desync_reported = 1;
+    }
+    if(recording){
+        for(int i = 0; i < keys.num; i++)
+            chip8_movie_key(&movie, frame, &keys.events[i]); // with the cycle and offset it landed on
+    }
+    if(latency_press_ns && frame - latency_press_frame >= LATENCY_TIMEOUT_FRAMES){
+        latency_unanswered++; // nothing on screen changed
+        latency_press_ns = 0;
+    }
+    if(c->halted && !c->exited)
+        error_out_of_stack(c); // dumps the machine and exits
+
+    // SUPER-CHIP and XO-CHIP games are written for faster interpreters
+    if(c->extensions != speed_extensions && !ipf_fixed){
+        speed_extensions = c->extensions;
+        int wanted = c->extensions & CHIP8_EXT_XOCHIP ? XOCHIP_IPF : c->extensions & CHIP8_EXT_SCHIP ? SCHIP_IPF : DEFAULT_IPF;
+        if(wanted > ipf)
+            set_ipf(c, wanted);
+    }
+
+    // DT and ST count in emulated frames, so they stay at 60 Hz per emulated second in turbo and fast-forward
+    chip8_tick_timers(c);
+
+    frame++;
+    if(rewind_history)
+        chip8_rewind_capture(rewind_history, c);
+}
+
+/* Run-ahead: show the machine as it will be `runahead` frames from now with
+   the keys held now, then put it back. A ROM that answers a key a frame or
+   two after reading it shows the answer that much sooner; the frames in
+   between run again for real, with whatever keys come by then. */
+static void present_ahead(chip8_t *c){
+    int idle = c->idle;
+    uint64_t idle_cycles = c->idle_cycles;
+    c->draw_screen_flag = 0; // the frame presented now covers whatever the real frames drew
+    uint64_t start = sched_now_ns();
+    chip8_snapshot_take(&ahead_snapshot, c);
+    uint64_t taken = sched_now_ns();
+    int ran = 0;
+    for(; ran < runahead && !c->halted; ran++){
+        chip8_run(c, ipf);
+        chip8_tick_timers(c);
+    }
+    publish_frame(c, frame + ran);
+    uint64_t restoring = sched_now_ns();
+    chip8_snapshot_restore(&ahead_snapshot, c);
+    if(ahead_count) // the first take copies all of MEMORY, keep it out of the average
+        ahead_ns += taken - start + sched_now_ns() - restoring;
+    ahead_count++;
+    c->idle = idle; // the sleep decision and the stats are about the real machine
+    c->idle_cycles = idle_cycles;
+}
+
+static void close_trace(void){
+    chip8_trace_close(trace);
+    trace = NULL;
+}
+
+// Emulation thread: input, the machine and the 60 Hz clock, one iteration per host frame
+static void *emulation_main(void *arg) {
+    (void)arg;
+    int publish = 1; // the first frame goes out even without a DRW
+    int ahead = 0; // frames ran forward this iteration, present their future
+    while(!atomic_load(&quit_requested)){
+        // Keys queued by the render thread since the last iteration
+        handle_input(&chip8);
+
+        // --- CHIP-8 Emulation ---
+        if(rewinding && rewind_history && !playing){
+            // one frame back per 60 Hz tick, so history plays backwards at real-time speed
+            int due = sched_ticks_due(&sched);
+            if(due == 0){
+                sched_wait(&sched);
+                continue;
+            }
+            while(due-- > 0 && chip8_rewind_step(rewind_history, &chip8))
+                frame--;
+            if(recording)
+                chip8_movie_truncate(&movie, frame); // record over what was rewound
+            ahead = 0;
+        } else if(turbo){
+            // as many emulated frames as fit before the next host frame is due
+            do {
+                emulate_frame(&chip8, 0, 0); // keys land at the start of the next frame
+            } while(sched_now_ns() < sched.next_ns);
+            sched_ticks_due(&sched);
+            ahead = runahead > 0;
+        } else {
+            // one emulated frame per 60 Hz tick (several after a short stall), more while fast-forwarding
+            int due = sched_ticks_due(&sched);
+            if(due == 0){
+                // a machine spinning on DT or the keys has nothing to show before the next frame runs
+                if(chip8.idle && !trace)
+                    sched_sleep(&sched);
+                else
+                    sched_wait(&sched); // sleep, then spin, until the next frame is due
+                continue;
             }
+            // the frames stand for the host time of the ticks just consumed, keys land where they fell in it
+            int count = due * (fast_forward ? FAST_FORWARD_FRAMES : 1);
+            uint64_t start_ns = sched_deadline(&sched, (int64_t)sched.tick - due - 1);
+            uint64_t span_ns = sched_deadline(&sched, (int64_t)sched.tick - 1) - start_ns;
+            for(int i = 0; i < count; i++)
+                emulate_frame(&chip8, start_ns + span_ns * i / count, start_ns + span_ns * (i + 1) / count);
+            ahead = runahead > 0;
         }
-    }
-    return 1; // Continue emulation
-}
-
 
-void inst_cls(){
-    // CLS - clear the display
-    for(int i = 0; i < SCRN_SIZE; i++) SCREEN[i] = 0; // black screen
-    draw_screen_flag = 1; // clear the screen immidietly
-    PC += 2;
-}
+        // Sound plays while ST is non-zero
+        backend->audio_gate(chip8.ST > 0);
 
-void inst_ret(){
-    // RET - return from a subroutine
-    PC = STACK[SP]; // set the address for the top of the stack
-    SP--; // substract 1 from stack pointer
-    if(SP < 0){
-        error_out_of_stack();
-    }
-    PC += 2;
-}
-
-void inst_jp(uint16_t address){
-    // JP addr - jump to a location address
-    PC = address;
-}
-
-void inst_call(uint16_t address){
-    // CALL addr - call a subroutine at addr
-    SP += 1;
-    if(SP > (STCK_SIZE - 1)){
-        error_out_of_stack();
-    }
-    STACK[SP] = PC;
-    PC = address;
-}
-
-void inst_se(uint8_t x, uint8_t kk){
-    // SE Vx, byte - skip next instruction if Vx = kk
-    if(V[x] == kk) PC += 4;
-    else{
-        PC += 2;
-    }
-}
-
-void inst_sne(uint8_t x, uint8_t kk){
-    // SNE Vx, byte - skip next instruction if Vx != kk
-    if(V[x] != kk) PC += 4;
-    else{
-        PC += 2;
-    }
-}
-
-void inst_ld(uint8_t x, uint8_t kk){
-    // LD Vx, byte - put the value kk into register Vx
-    V[x] = kk;
-    PC += 2;
-}
-
-void inst_add(uint8_t x, uint8_t kk){
-    // ADD Vx, byte - adds the value byte to value of register Vx and stores result in Vx
-    V[x] += kk;
-    PC += 2;
-}
-
-void inst_or(uint8_t x, uint8_t y){
-    // OR Vx, Vy - bitwise OR on the values Vx and Vy and store result in Vx
-    V[x] = V[x] | V[y];
-    PC += 2;
-}
-
-void inst_and(uint8_t x, uint8_t y){
-    // AND Vx, Vy - bitwise AND on the values Vx and Vy and store result in Vx
-    V[x] = V[x] & V[y];
-    PC += 2;
-}
-
-void inst_xor(uint8_t x, uint8_t y){
-    // XOR Vx, Vy - bitwise XOR on the values Vx and Vy and store result in Vx
-    V[x] = V[x] ^ V[y];
-    PC += 2;
-}
-
-void inst_add_vx_vy(uint8_t x, uint8_t y){
-    // ADD Vx, Vy - The values of Vx and Vy are added together, if the result is greater that 8 bits then VF is set to 1, otherwise 0
-    uint16_t sum = 0;
-    sum = V[x] + V[y];
-    V[x] = sum & 0x00ff; // only 8 bits are stored in V[x]
-    if((sum & 0xff00) == 0x0000){ // no overflow
-        V[0xf] = 0;
-    }
-    else{
-        V[0xf] = 1;
-    }
-    PC += 2;
-}
+        if(chip8.exited){
+            printf("ROM exited (00FD)\n");
+            break;
+        }
 
-void inst_sub_vx_vy(uint8_t x, uint8_t y){
-    // SUB Vx, Vy - Vx minus Vy and store in Vx, set VF to 1 if Vx > Vy
-    if(V[x] > V[y]){
-        V[0xf] = 1;
-    }
-    else{
-        V[0xf] = 0;
+        // At most one frame per iteration, however many DRW/CLS ran during it
+        if(ahead){
+            present_ahead(&chip8); // every time, the future may differ even when the present did not
+            publish = 0;
+        } else if(chip8.draw_screen_flag || publish){
+            publish_frame(&chip8, frame);
+            publish = 0;
+        }
     }
-    V[x] -= V[y];
-    PC += 2;
+    atomic_store(&emulation_done, 1);
+    backend->wake();
+    return NULL;
+}
+
+static void usage(const char *prog){
+    printf("Usage: %s <path_to_rom> [-d | -trace file] [-ipf n] [-turbo] [-stats] [-audiobuf n] [-load state] [-rewind mb]\n", prog);
+    printf("       [-seed n] [-record movie | -play movie] [-profile prefix] [-quirks spec | -quirkdb file] [-noidle] [-latency]\n");
+    printf("       [-runahead n] [-backend name] [-capture file]\n");
+    printf("  -d        log every executed opcode to <path_to_rom>.c8t (read it with chip8_trace)\n");
+    printf("  -trace file  the same, to the given file\n");
+    printf("  -ipf n    instructions per frame (default %d, %d for SUPER-CHIP and %d for XO-CHIP ROMs, max %d)\n",
+           DEFAULT_IPF, SCHIP_IPF, XOCHIP_IPF, MAX_IPF);
+    printf("  -turbo    run unthrottled\n");
+    printf("  -stats    print frame pacing and audio statistics on exit\n");
+    printf("  -audiobuf n  audio buffer in samples (default %d)\n", AUDIO_DEFAULT_BUFFER);
+    printf("  -load state  resume from a save state after loading the ROM\n");
+    printf("  -rewind mb   memory for rewind history (default %d, 0 disables)\n", DEFAULT_REWIND_MB);
+    printf("  -seed n      seed RND instead of using the time\n");
+    printf("  -record movie  log keypad input from power-on, saved on exit\n");
+    printf("  -play movie    replay a recorded movie (also: chip8_batch -jobs)\n");
+    printf("  -profile prefix  write <prefix>.folded and <prefix>.json on exit (make PROFILE=1)\n");
+    printf("  -quirks spec     CHIP-8 variant behaviour, a profile or quirk list (-quirks list shows them)\n");
+    printf("  -quirkdb file    per-ROM quirks by ROM hash (default %s, when present)\n", CHIP8_QUIRKS_DB);
+    printf("  -noidle   run spin loops on DT and the keys opcode by opcode instead of skipping them\n");
+    printf("  -latency  print the time from each key press to the present of the first frame it changed\n");
+    printf("  -runahead n  present the machine n frames ahead to hide a ROM's input lag (max %d,\n", CHIP8_RUNAHEAD_MAX);
+    printf("               default the quirk database's runahead=n for the ROM, else 0)\n");
+    printf("  -backend name  display, audio and keys: %s by default, -backend list shows them\n", BACKEND_DEFAULT);
+    printf("  -capture file  write the frames shown to file.y4m (128x64 video) or numbered file.png images\n");
+    printf("Hotkeys: - / = halve / double IPF, F1 toggles turbo, hold Tab to fast-forward, hold Backspace to rewind\n");
+    printf("         F5 / F9 save / load <path_to_rom>.c8s\n");
 }
 
-void inst_shr(uint8_t x){
-    // SHR Vx - If the least-significant bit of Vx is 1, then VF is set to 1, then Vx is divided by 2
-    V[0xf] = V[x] & 0x1;
-    V[x] >>= 1;
-    PC += 2;
-}
-
-void inst_subn_vx_vy(uint8_t x, uint8_t y){
-    // SUBN Vx, Vy - Vy minus Vx and store in Vx, set VF to 1 if Vy > Vx
-    if(V[x] < V[y]){
-        V[0xf] = 1;
-    }
-    else{
-        V[0xf] = 0;
+int main(int argc, char* argv[]){
+    launched_ns = sched_now_ns();
+    // Check if a ROM file path was provided as a command-line argument
+    const char *trace_path = NULL; // no trace by default
+    char debug_trace[1024];
+    int stats = 0;
+    int audio_buffer = AUDIO_DEFAULT_BUFFER;
+    const char *load_state = NULL;
+    int rewind_mb = DEFAULT_REWIND_MB;
+    const char *play_path = NULL;
+    const char *profile_prefix = NULL;
+    int seed_set = 0;
+    uint32_t seed = 0;
+    int quirks = -1; // -1: whatever the database lists for the ROM
+    const char *quirk_db = NULL;
+    int idle_skip = 1; // skip spin loops on DT and the keys, see chip8_run()
+    int runahead_set = 0;
+    const char *capture_path = NULL;
+    backend = backend_find(BACKEND_DEFAULT);
+    if(argc < 2){
+        usage(argv[0]);
+        return 1;
     }
-    V[x] = V[y] - V[x];
-    PC += 2;
-}
-
-void inst_shl(uint8_t x){
-    // SHL Vx - if the most-significant bit of Vx is 1, then VF = 1, then Vx multiplied by 2
-    V[0xf] = (V[x] >> 7) & 0x1;
-    V[x] <<=1;
-    PC += 2;
-}
-
-void inst_ld_addr(uint16_t addr){
-    // LD I, addr - I is set to addr
-    I = addr;
-    PC += 2;
-}
-
-void inst_jp_v0(uint16_t addr){
-    // JP V0, addr - jump to location addr + V0
-    PC = addr + V[0x0];
-}
-
-void inst_rnd(uint8_t x, uint8_t kk){
-    // RND Vx, byte - Generate random number, AND it with kk and store in Vx
-    int randomNumber = (rand() % 256) & kk;
-    V[x] = randomNumber;
-    PC += 2;
-}
-
-void inst_drw(uint8_t x, uint8_t y, uint8_t n){
-    // DRW Vx, Vy, nibble - display n-byte sprite starting at memory location I at (Vx, Vx), set VF = collision
-    uint8_t vx = V[x] % 64; // width
-    uint8_t vy = V[y] % 32; // height
-    V[0xf] = 0; // reset the collision flag
-    for(int row = 0; row < n; row++){
-        uint8_t sprite_byte = MEMORY[I+row];
-        for(int col = 0; col < 8; col++){
-            uint8_t pixel_sprite = (sprite_byte >> (7 - col)) & 0x1;
-
-            uint8_t x_coord = (vx + col) % 64;
-            uint8_t y_coord = (vy + row) % 32;
-            int screen_index = y_coord * 64 + x_coord;
-
-            if(pixel_sprite){
-                if(SCREEN[screen_index] == 1){
-                    V[0xf] = 1; // collision detected
-                }
-                SCREEN[screen_index] ^= 1;
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "-d") == 0){
+            snprintf(debug_trace, sizeof(debug_trace), "%s.c8t", argv[1]);
+            trace_path = debug_trace;
+        }
+        else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if(strcmp(argv[i], "-ipf") == 0 && i + 1 < argc){
+            ipf = atoi(argv[++i]);
+            ipf_fixed = 1;
+        }
+        else if(strcmp(argv[i], "-turbo") == 0)
+            turbo = 1;
+        else if(strcmp(argv[i], "-stats") == 0)
+            stats = 1;
+        else if(strcmp(argv[i], "-audiobuf") == 0 && i + 1 < argc)
+            audio_buffer = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-load") == 0 && i + 1 < argc)
+            load_state = argv[++i];
+        else if(strcmp(argv[i], "-rewind") == 0 && i + 1 < argc)
+            rewind_mb = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc){
+            seed = strtoul(argv[++i], NULL, 10);
+            seed_set = 1;
+        }
+        else if(strcmp(argv[i], "-record") == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if(strcmp(argv[i], "-play") == 0 && i + 1 < argc)
+            play_path = argv[++i];
+        else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+            profile_prefix = argv[++i];
+        else if(strcmp(argv[i], "-quirks") == 0 && i + 1 < argc){
+            if(strcmp(argv[++i], "list") == 0){
+                chip8_quirks_print();
+                return 0;
+            }
+            if((quirks = chip8_quirks_parse(argv[i])) < 0){
+                printf("Unknown quirks '%s', -quirks list shows them\n", argv[i]);
+                return 1;
             }
         }
+        else if(strcmp(argv[i], "-quirkdb") == 0 && i + 1 < argc)
+            quirk_db = argv[++i];
+        else if(strcmp(argv[i], "-noidle") == 0)
+            idle_skip = 0;
+        else if(strcmp(argv[i], "-latency") == 0)
+            latency_mode = 1;
+        else if(strcmp(argv[i], "-backend") == 0 && i + 1 < argc){
+            if(strcmp(argv[++i], "list") == 0){
+                backend_print();
+                return 0;
+            }
+            if((backend = backend_find(argv[i])) == NULL){
+                printf("Unknown backend '%s', -backend list shows them\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-capture") == 0 && i + 1 < argc)
+            capture_path = argv[++i];
+        else if(strcmp(argv[i], "-runahead") == 0 && i + 1 < argc){
+            runahead = atoi(argv[++i]);
+            runahead_set = 1;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
     }
-    draw_screen_flag = 1;
-    PC += 2;
-}
-
-void inst_skp(uint8_t x){
-    // SKP Vx - skip next instruction if key is pressed (key value is stored in Vx)
-    if(KEYBOARD[V[x]]){
-        PC += 4;
-    }
-    else{
-        PC += 2;
+    if((record_path || play_path) && load_state){
+        printf("Movies start from power-on, -record and -play cannot be combined with -load\n");
+        return 1;
     }
-}
-
-void inst_sknp(uint8_t x){
-    // SKNP Vx - skip next instruction if key is not pressed
-    if(!KEYBOARD[V[x]]){
-        PC += 4;
+    if(record_path && play_path){
+        usage(argv[0]);
+        return 1;
     }
-    else{
-        PC += 2;
+    if(audio_buffer < 16 || audio_buffer > 8192){
+        printf("Audio buffer must be between 16 and 8192 samples\n");
+        return 1;
     }
-}
-
-void inst_ld_dt(uint8_t x){
-    // LD Vx, DT - set Vx to delay timer value
-    V[x] = DT;
-    PC += 2;
-}
-
-void inst_ld_k(uint8_t x){
-    // LD Vx, K - wait for a key press, store the value of key in Vx
-    waiting_for_key = 1;
-    key_dest = x;
-    key_press_buffer = -1;
-}
-
-void inst_dt_ld(uint8_t x){
-    // LD DT, Vx - set display timer to Vx
-    DT = V[x];
-    PC += 2;
-}
-
-void inst_st_ld(uint8_t x){
-    // LD ST, Vx - set sound timer to Vx
-    ST = V[x];
-    PC += 2;
-}
-
-void inst_add_i(uint8_t x){
-    // ADD I, Vx - set I = I + Vx
-    I += V[x];
-    PC += 2;
-}
-
-void inst_f_ld(uint8_t x){
-    // LD F, Vx - set I = location of sprite for digit Vx
-    I = V[x] * 5; // sprites are 5 bytes long
-    PC += 2;
-}
-
-void inst_bcd_ld(uint8_t x){
-    // LD B, Vx - store BCD representation of Vx in memory locations I, I+1 and I+2
-    MEMORY[I] = (V[x] % 1000 - V[x] % 100) / 100;
-    MEMORY[I+1] = (V[x] % 100 - V[x] % 10) / 10;
-    MEMORY[I+2] = V[x] % 10;
-    PC += 2;
-}
-
-void inst_store_registers(uint8_t x){
-    // LD [I], Vx - copy registers to memory
-    for(int i = 0; i < x+1; i++){
-        MEMORY[I+i] = V[i];
+    if(ipf < 1 || ipf > MAX_IPF){
+        printf("IPF must be between 1 and %d\n", MAX_IPF);
+        return 1;
     }
-    PC += 2;
-}
-
-void inst_read_registers(uint8_t x){
-    // LD Vx, [I] - read from memory to registers
-    for(int i = 0; i < x+1; i++){
-        V[i] = MEMORY[I+i];
+    if(runahead < 0 || runahead > CHIP8_RUNAHEAD_MAX){
+        printf("Run-ahead must be between 0 and %d frames\n", CHIP8_RUNAHEAD_MAX);
+        return 1;
     }
-    PC += 2;
-}
-
 
-
-void decodeAndExecute(uint16_t opcode){
-    /*
-    opcode = 
-               fb      sb
-            ________|________
-            8 bits  | 8 bits
-
-    fb =
-            fs    ss
-            ____|____
-            4-b | 4-b
-
-    sb = 
-            ts    fs
-            ____|____
-            4-b | 4-b
-     */
-    uint8_t fb = (opcode >> 8) & 0xff; //first byte
-    uint8_t fs = (fb >> 4) & 0x0f; //first symbol
-    uint8_t ss = fb & 0x0f; //second symbol
-
-    uint8_t sb = opcode & 0x00ff; //second byte
-    uint8_t ts = (sb >> 4) & 0x0f; // third symbol
-    uint8_t ffs = sb & 0x0f; // fourth symbol
-    // some instructions requires 2-nd, 3-rd and 4-th bytes as address
-    uint16_t nnn = opcode & 0x0fff;
-
-    switch(fs){
-        case 0x0: // CLS or SYS or RET
-            if(sb == 0xe0){
-                inst_cls();
-            }
-            else if(sb == 0xee){
-                inst_ret();
-            }
-            else{
-                // TODO: SYS addr ([0]=ss, [1]=ts, [2]=ffs)
-                // As Cowgos's Technical reference says, this instruction is only used on the old computers and is not supported in modern interpreters, but I will add it for backward compatibility
-                //inst_jp(nnn);
-                PC += 2;
-            }
-            break;
-        case 0x1: // JP addr ([0]=ss, [1]=ts, [2] = ffs)
-            inst_jp(nnn);
-            break;
-        case 0x2: // CALL addr ([0]=ss, [1,2]=sb)
-            inst_call(nnn);
-            break;
-        case 0x3: // SE Vx (x=ss), byte (byte=sb)
-            inst_se(ss, sb);
-            break;
-        case 0x4: // SNE Vx (x=ss), byte (byte=sb)
-            inst_sne(ss, sb);
-            break;
-        case 0x5: // SE Vx (x=ss), Vy (y=ts)
-            inst_se(ss, V[ts]);
-            break;
-        case 0x6: // LD Vx (x=ss), byte (byte=sb)
-            inst_ld(ss, sb);
-            break;
-        case 0x7: // ADD Vx (xx=ss), byte (byte=sb)
-            inst_add(ss, sb);
-            break;
-        case 0x8: 
-            switch(ffs){
-                case 0x0: // LD Vx (x=ss), Vy (y=ts)
-                    inst_ld(ss, V[ts]);
-                    break;
-                case 0x1: // OR Vx (x=ss), Vy (y=ts)
-                    inst_or(ss, ts);
-                    break;
-                case 0x2: // AND Vx, Vy
-                    inst_and(ss, ts);
-                    break;
-                case 0x3: // XOR Vx, Vy
-                    inst_xor(ss, ts);
-                    break;
-                case 0x4: // ADD Vx, Vy
-                    inst_add_vx_vy(ss, ts);
-                    break;
-                case 0x5: // SUB Vx, Vy
-                    inst_sub_vx_vy(ss, ts);
-                    break;
-                case 0x6: // SHR Vx, Vy
-                    inst_shr(ss);
-                    break;
-                case 0x7: // SUBN Vx, Vy
-                    inst_subn_vx_vy(ss, ts);
-                    break;
-                case 0xe: // SHL Vx, Vy
-                    inst_shl(ss);
-                    break;
-                default:
-                    inst_cls();
-                    break;
-            }
-            break;
-        case 0x9: // SNE Vx (x=ss), Vy (y=ts)
-            inst_sne(ss, V[ts]);
-            break;
-        case 0xa: // LD I, addr ([0]=ss, [1,2]=sb)
-            inst_ld_addr(nnn);
-            break;
-        case 0xb: // JP V0, addr ([0]=ss, [1,2]=sb)
-            inst_jp_v0(nnn);
-            break;
-        case 0xc: // RND Vx (x=ss), byte (kk=sb)
-            inst_rnd(ss, sb);
-            break;
-        case 0xd: // DRW Vx (x=ss), Vy (y=ts), nibble (nibble=ffs)
-            inst_drw(ss, ts, ffs);
-            break;
-        case 0xe:
-            if(sb == 0x9e){
-                // SKP Vx (x=ss)
-                inst_skp(ss);
-            }
-            else if (sb == 0xa1){
-                // SKNP Vx (x=ss)
-                inst_sknp(ss);
-            }
-            break;
-        case 0xf:
-            switch(sb){
-                case 0x07: // LD Vx, DT
-                    inst_ld_dt(ss);
-                    break;
-                case 0x0a: // LD Vx, K
-                    inst_ld_k(ss);
-                    break;
-                case 0x15: // LD DT, Vx
-                    inst_dt_ld(ss);
-                    break;
-                case 0x18: // LD ST, Vx
-                    inst_st_ld(ss);
-                    break;
-                case 0x1e: // ADD I, Vx
-                    inst_add_i(ss);
-                    break;
-                case 0x29: // LD F, Vx
-                    inst_f_ld(ss);
-                    break;
-                case 0x33: // LD B, Vx
-                    inst_bcd_ld(ss);
-                    break;
-                case 0x55: // LD [I], Vx
-                    inst_store_registers(ss);
-                    break;
-                case 0x65: // LD Vx, [I]
-                    inst_read_registers(ss);
-                    break;
-                default:
-                    inst_cls();
-                    break;
-            }
-            break;
-        default:
-            inst_cls();
-            printf("Error: unknown opcode '%u'\n", fs);
-            break;
+    // Initialize the CHIP-8 machine and the backend
+    init_machine(&chip8);
+    chip8.idle_skip = idle_skip;
+    if(!chip8_jit_enable(&chip8)) // the block cache alone where there is no JIT
+        chip8_bcache_enable(&chip8);
+    if(trace_path){
+        if((trace = chip8_trace_open(trace_path)) == NULL)
+            return 1;
+        atexit(close_trace); // error_out_of_stack() exits, the opcodes leading up to it matter most
     }
-}
-
-
-int main(int argc, char* argv[]){
-    // Check if a ROM file path was provided as a command-line argument
-    int debug = 0; // debug is off by default
-    if(argc < 2){
-        printf("Usage: %s <path_to_rom>\n", argv[0]);
+    if(profile_prefix && !chip8_profile_enable(&chip8)){
+        printf("-profile needs a build with profiling compiled in (make PROFILE=1)\n");
         return 1;
     }
-    if(argv[2] != NULL && strcmp(argv[2], "-d") == 0)
-        debug = 1;
-
-    // Initialize the CHIP-8 machine and SDL
-    init_machine();
-    // Set up the keyboard mapping for SDL scancodes to CHIP-8 keys
-    setup_key_map();
-
-    // --- SDL Audio Setup ---
-    SDL_AudioSpec desiredSpec, obtainedSpec;
-
-    SDL_zero(desiredSpec); // Initialize to all zeros
-    desiredSpec.freq = SAMPLE_RATE;        // Sample rate
-    desiredSpec.format = AUDIO_S16SYS;     // Signed 16-bit audio in system byte order
-    desiredSpec.channels = 1;              // Mono
-    desiredSpec.samples = NUM_SAMPLES;     // Buffer size (power of 2 is good)
-    desiredSpec.callback = audio_callback; // Our callback function
-    desiredSpec.userdata = NULL;           // No user data
-
-     // Open the audio device
-    if (SDL_OpenAudio(&desiredSpec, &obtainedSpec) < 0) {
-        fprintf(stderr, "Failed to open audio: %s\n", SDL_GetError());
-        return 1; // Or handle error appropriately
-    }
-    // --- End SDL Audio Setup ---
+    if(capture_path && (capture = capture_open(capture_path)) == NULL)
+        return 1;
+    if(!backend->init(audio_buffer))
+        return 1;
 
     // Attempt to load the specified ROM file
-    if(!load_rom(argv[1])){
+    if(!load_rom(&chip8, argv[1])){
         // If ROM loading fails, exit with an error
         return 1;
     }
-
-    // Main emulation loop variables
-    int quit = 0; // Flag to control the main loop (0 to continue, 1 to quit)
-
-    // Timestamps for managing frame rate and timer updates
-    uint32_t last_timer_update = SDL_GetTicks(); // Time of last timer decrement
-    uint32_t last_frame_time = SDL_GetTicks();   // Time of last screen render/frame sync
-
-    // Configuration for emulation speed: number of CHIP-8 cycles to run per 60Hz frame
-    const int CYCLES_PER_FRAME = 10;
-    int cycles_executed_this_frame = 0; // Counter for cycles executed within the current frame
-
-    // Main emulation loop
-    while(!quit){
-        // Handle user input (keyboard and window close events)
-        if(!handle_input()){
-            quit = 1; // If handle_input returns 0, quit the emulator
-            continue; // Skip the rest of the loop and terminate
-        }
-
-        // --- CHIP-8 Emulation Cycle ---
-        if(!waiting_for_key){
-            // If not waiting for a key press, execute opcodes
-            if (cycles_executed_this_frame < CYCLES_PER_FRAME) {
-                // Fetch the 16-bit opcode from memory (PC points to the first byte)
-                uint16_t opcode = MEMORY[PC] << 8 | MEMORY[PC + 1];
-
-                if(debug)
-                    printf("Executing %x opcode at memory %x\n", opcode, PC);
-
-                decodeAndExecute(opcode); // Decode and execute the instruction
-                cycles_executed_this_frame++; // Increment cycle counter
-            }
-
-            // If a DRW instruction was executed and signaled a screen redraw
-            if(draw_screen_flag){
-                draw_graphics();      // Perform the drawing operation
-                draw_screen_flag = 0; // Reset the flag
-            }
-        } else {
-            // Check if handle_input() has populated key_press_buffer with a new key press
-            if (key_press_buffer != -1) { // A key has been pressed since FX0A was called
-                V[key_dest] = key_press_buffer; // Store the pressed key's value in Vx
-                waiting_for_key = 0;            // Exit the waiting state
-                PC += 2;                        // Advance PC, as the instruction is now complete
-            } else {
-                // No key has been pressed yet for FX0A, so we continue waiting.
-                // We should avoid processing more opcodes until a key is found.
-                // A small delay here is good to prevent busy-waiting.
-                SDL_Delay(10);
-                continue; // Skip timer updates and frame rate control, just keep polling for key
-            }
+    // the ROM's quirks: -quirks, else its database entry, else modern; states and movies bring their own
+    uint64_t rom_hash = chip8_memory_hash(&chip8);
+    if(quirks < 0){
+        quirks = chip8_quirks_lookup(quirk_db ? quirk_db : CHIP8_QUIRKS_DB, rom_hash);
+        if(quirks == -2 && quirk_db){
+            printf("Error: could not read quirk database '%s'\n", quirk_db);
+            return 1;
         }
+    }
+    chip8_set_quirks(&chip8, quirks < 0 ? CHIP8_QUIRKS_MODERN : quirks);
+    // run-ahead the same way: -runahead, else the database, else none
+    if(!runahead_set && (runahead = chip8_runahead_lookup(quirk_db ? quirk_db : CHIP8_QUIRKS_DB, rom_hash)) < 0)
+        runahead = 0;
+    if(runahead && chip8.profile){
+        printf("Run-ahead is off while profiling, its frames would be counted twice\n");
+        runahead = 0;
+    }
+    if(load_state && !chip8_load_state(&chip8, load_state))
+        return 1;
+    if(seed_set)
+        chip8_seed(&chip8, seed);
+    if(play_path){
+        if(!chip8_movie_load(&movie, play_path))
+            return 1;
+        if(movie.seed)
+            chip8_seed(&chip8, movie.seed);
+        if(movie.ipf)
+            ipf = movie.ipf;
+        ipf_fixed = 1; // speed changes are in the movie
+        if(movie.rom_hash && movie.rom_hash != rom_hash)
+            printf("Warning: movie was recorded with a different ROM\n");
+        if(movie.has_quirks)
+            chip8_set_quirks(&chip8, movie.quirks);
+        playing = 1;
+    }
+    if(record_path){
+        chip8_movie_start(&movie, &chip8, ipf);
+        recording = 1;
+    }
+    char quirk_name[CHIP8_QUIRKS_NAME_MAX];
+    printf("ROM hash %016llx, quirks %s", (unsigned long long)rom_hash, chip8_quirks_name(chip8.quirks, quirk_name, sizeof(quirk_name)));
+    if(runahead)
+        printf(", %d frames of run-ahead", runahead);
+    printf("\n");
+    // decode (and compile) the code reachable from PC now rather than on its first run
+    int prewarmed = chip8_prewarm(&chip8);
+    snprintf(quick_state, sizeof(quick_state), "%s.c8s", argv[1]);
+    if(rewind_mb > 0 && (rewind_history = chip8_rewind_create((size_t)rewind_mb << 20, REWIND_KEYFRAME_INTERVAL)) == NULL)
+        printf("Not enough memory for rewind, continuing without it\n");
+
+    // 60 Hz frame clock
+    sched_init(&sched, 60, MAX_CATCH_UP);
+    frames_init(&frames);
+    pthread_t emulation_thread;
+    if(pthread_create(&emulation_thread, NULL, emulation_main, NULL) != 0){
+        printf("Error: could not start the emulation thread\n");
+        return 1;
+    }
 
-        // --- Timer Update and Frame Rate Control ---
-        uint32_t current_time = SDL_GetTicks();
-
-        // Update timers (DT and ST) at approximately 60 Hz
-        if (current_time - last_timer_update >= (1000 / 60)) {
-            if (DT > 0) DT--; // Decrement Delay Timer if active
-            if (ST > 0) {
-                ST--; // Decrement Sound Timer if active
-
-                if (ST > 0) {
-                    // If ST is still greater than 0, keep playing sound
-                    if (!audio_playing) {
-                        SDL_PauseAudio(0); // Unpause audio, start playing
-                        audio_playing = 1;
-                    }
-                } else {
-                    // If ST just reached 0, stop playing sound
-                    if (audio_playing) {
-                        SDL_PauseAudio(1); // Pause audio, stop playing
-                        audio_playing = 0;
-                    }
-                }
-            } else {
-                // If ST is already 0, ensure sound is off
-                if (audio_playing) {
-                    SDL_PauseAudio(1); // Pause audio
-                    audio_playing = 0;
-                }
-            }
-            last_timer_update = current_time; // Reset timer update timestamp
+    // Render loop: input events in, the newest finished frame out; the emulation thread never waits on it
+    const frame_t *current = NULL; // stays ours until the next frames_latest()
+    while(!atomic_load(&emulation_done)){
+        if(!backend->poll_input(&input)){
+            atomic_store(&quit_requested, 1);
+            break;
         }
-
-        // Synchronize drawing and reset cycle counter for the next frame
-        // This ensures the display updates at a consistent rate (approx. 60 FPS)
-        if (current_time - last_frame_time >= (1000 / 60)) {
-            cycles_executed_this_frame = 0; // Reset cycles for the new frame
-            last_frame_time = current_time;   // Reset frame time
+        const frame_t *latest = frames_latest(&frames);
+        if(latest)
+            current = latest;
+        if(current && backend->present(current, latest != NULL)){
+            if(latency_mode)
+                report_latency(current);
         } else {
-            // If we're ahead of schedule for the 60FPS frame rate,
-            // introduce a small delay to prevent busy-waiting.
-            SDL_Delay(1);
+            // until input, or the emulation thread's wakeup for a new frame
+            backend->wait(RENDER_WAIT_MS);
         }
     }
-
-    // --- Cleanup SDL Resources ---
-    SDL_DestroyTexture(sdlTexture);
-    SDL_DestroyRenderer(sdlRenderer);
-    SDL_DestroyWindow(sdlWindow);
-    SDL_CloseAudio(); // Close the audio device
-    SDL_Quit(); // Quit SDL subsystems
+    pthread_join(emulation_thread, NULL);
+
+    if(recording)
+        stop_recording();
+    chip8_movie_free(&movie);
+
+    if(profile_prefix)
+        chip8_profile_write(&chip8, profile_prefix);
+    if(trace){
+        if(stats)
+            printf("trace: %llu opcodes, writer fell behind %llu times\n",
+                   (unsigned long long)chip8_trace_records(trace), (unsigned long long)chip8_trace_stalls(trace));
+        close_trace();
+    }
+    // the last frame stays on until the machine stopped
+    capture_close(capture, frame, stats ? stdout : NULL);
+
+    if(latency_mode){
+        if(latency_count)
+            printf("latency: %llu presses, mean %.2f frames, min %.2f, max %.2f (%.1f / %.1f / %.1f ms)\n",
+                   (unsigned long long)latency_count, latency_sum_ms / latency_count * 60 / 1000,
+                   latency_min_ms * 60 / 1000, latency_max_ms * 60 / 1000,
+                   latency_sum_ms / latency_count, latency_min_ms, latency_max_ms);
+        printf("latency: %llu presses changed nothing on screen within %d frames\n",
+               (unsigned long long)latency_unanswered, LATENCY_TIMEOUT_FRAMES);
+    }
+    if(stats){
+        if(first_frame_ns)
+            printf("startup: %.3f ms from launch to the first frame\n", (first_frame_ns - launched_ns) / 1e6);
+        printf("prewarm: %d blocks decoded before the first frame\n", prewarmed);
+        if(ahead_count > 1)
+            printf("runahead: %llu snapshots, %.0f ns each to take and restore\n",
+                   (unsigned long long)ahead_count, (double)ahead_ns / (ahead_count - 1));
+        if(chip8.cycles)
+            printf("idle: %llu of %llu opcodes skipped in spin loops\n",
+                   (unsigned long long)chip8.idle_cycles, (unsigned long long)chip8.cycles);
+        sched_print_stats(&sched, stdout);
+        printf("handoff: %llu frames published, %llu picked up by the renderer, %llu key events dropped\n",
+               (unsigned long long)frames.published, (unsigned long long)frames.picked_up, (unsigned long long)input.dropped);
+        backend->print_stats(stdout);
+        if(rewind_history)
+            printf("rewind: %d frames in %zu bytes\n", chip8_rewind_frames(rewind_history), chip8_rewind_bytes(rewind_history));
+    }
+
+    backend->quit();
+    chip8_jit_disable(&chip8);
+    chip8_bcache_disable(&chip8);
+    chip8_profile_disable(&chip8);
+    chip8_rewind_free(rewind_history);
 
     return 0; // Program exited successfully
 }
@@ -0,0 +1,155 @@
+// Input movies: keypad changes by emulated frame, replayed bit-identically
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+#include "quirks.h"
+
+static void add_event(chip8_movie_t *m, const chip8_movie_event_t *ev){
+    if(m->num_events == m->cap){
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->events = realloc(m->events, m->cap * sizeof(chip8_movie_event_t));
+    }
+    // keep frame order but never reorder events of the same frame (a tap is a down then an up)
+    int i = m->num_events++;
+    while(i > 0 && m->events[i - 1].frame > ev->frame){
+        m->events[i] = m->events[i - 1];
+        i--;
+    }
+    m->events[i] = *ev;
+}
+
+int chip8_movie_load(chip8_movie_t *m, const char *path){
+    memset(m, 0, sizeof(*m));
+    FILE *f = fopen(path, "r");
+    if(f == NULL){
+        fprintf(stderr, "Error: could not open movie '%s'\n", path);
+        return 0;
+    }
+    char line[256], spec[128];
+    while(fgets(line, sizeof(line), f)){
+        chip8_movie_event_t ev = {0};
+        unsigned frame, key, down, value, at;
+        unsigned long long cycle, hash;
+        int fields;
+        ev.cycle = MOVIE_NO_CYCLE;
+        ev.at = -1;
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "seed %u", &value) == 1) m->seed = value;
+        else if(sscanf(line, "ipf %u", &value) == 1) m->ipf = value;
+        else if(sscanf(line, "rom %llx", &hash) == 1) m->rom_hash = hash;
+        else if(sscanf(line, "frames %u", &value) == 1) m->frames = value;
+        else if(sscanf(line, "quirks %127s", spec) == 1){
+            if((m->quirks = chip8_quirks_parse(spec)) < 0){
+                fprintf(stderr, "Error: movie '%s' has unknown quirks '%s'\n", path, spec);
+                chip8_movie_free(m);
+                fclose(f);
+                return 0;
+            }
+            m->has_quirks = 1;
+        }
+        else if((fields = sscanf(line, "%u ipf %u %llu", &frame, &value, &cycle)) >= 2){
+            ev.frame = frame;
+            ev.type = MOVIE_IPF;
+            ev.ipf = value;
+            if(fields == 3) ev.cycle = cycle;
+            add_event(m, &ev);
+        }
+        else if((fields = sscanf(line, "%u %x %u %llu %u", &frame, &key, &down, &cycle, &at)) >= 3 && key <= 0xf){
+            ev.frame = frame;
+            ev.type = MOVIE_KEY;
+            ev.key = key;
+            ev.down = down != 0;
+            if(fields >= 4) ev.cycle = cycle;
+            if(fields == 5) ev.at = at;
+            add_event(m, &ev);
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+int chip8_movie_save(const chip8_movie_t *m, const char *path){
+    FILE *f = fopen(path, "w");
+    if(f == NULL){
+        fprintf(stderr, "Error: could not create movie '%s'\n", path);
+        return 0;
+    }
+    fprintf(f, "# chip8 movie\nseed %u\nipf %d\nrom %016llx\nframes %u\n",
+            m->seed, m->ipf, (unsigned long long)m->rom_hash, m->frames);
+    if(m->has_quirks){
+        char buf[CHIP8_QUIRKS_NAME_MAX];
+        fprintf(f, "quirks %s\n", chip8_quirks_name(m->quirks, buf, sizeof(buf)));
+    }
+    for(int i = 0; i < m->num_events; i++){
+        const chip8_movie_event_t *ev = &m->events[i];
+        if(ev->type == MOVIE_IPF)
+            fprintf(f, "%u ipf %d %llu\n", ev->frame, ev->ipf, (unsigned long long)ev->cycle);
+        else
+            fprintf(f, "%u %X %d %llu %d\n", ev->frame, ev->key, ev->down, (unsigned long long)ev->cycle, ev->at);
+    }
+    int ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+void chip8_movie_free(chip8_movie_t *m){
+    free(m->events);
+    memset(m, 0, sizeof(*m));
+}
+
+uint64_t chip8_memory_hash(const chip8_t *c){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < MEM_SIZE; i++){
+        hash ^= c->MEMORY[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void chip8_movie_start(chip8_movie_t *m, const chip8_t *c, int ipf){
+    memset(m, 0, sizeof(*m));
+    m->seed = c->rng; // chip8_seed() with this reproduces the RNG exactly
+    m->ipf = ipf;
+    m->rom_hash = chip8_memory_hash(c);
+    m->quirks = c->quirks;
+    m->has_quirks = 1;
+}
+
+void chip8_movie_key(chip8_movie_t *m, uint32_t frame, const chip8_input_event_t *key){
+    chip8_movie_event_t ev = {frame, MOVIE_KEY, key->key, key->down, 0, key->applied, key->at};
+    add_event(m, &ev);
+}
+
+void chip8_movie_ipf(chip8_movie_t *m, uint32_t frame, const chip8_t *c, int ipf){
+    chip8_movie_event_t ev = {frame, MOVIE_IPF, 0, 0, ipf, c->cycles, -1};
+    add_event(m, &ev);
+}
+
+void chip8_movie_truncate(chip8_movie_t *m, uint32_t frame){
+    while(m->num_events > 0 && m->events[m->num_events - 1].frame >= frame)
+        m->num_events--;
+}
+
+int chip8_movie_input(const chip8_movie_t *m, int *next, uint32_t frame, const chip8_t *c, int *ipf, chip8_input_t *in){
+    int in_sync = 1;
+    while(*next < m->num_events && m->events[*next].frame <= frame){
+        const chip8_movie_event_t *ev = &m->events[*next];
+        if(ev->type == MOVIE_IPF){
+            if(ev->cycle != MOVIE_NO_CYCLE && ev->cycle != c->cycles)
+                in_sync = 0;
+            *ipf = ev->ipf;
+        } else {
+            chip8_input_event_t key = { 0, ev->key, ev->down, ev->cycle, 0, 0 };
+            if(ev->at >= 0)
+                key.at = ev->at;
+            else if(ev->cycle != MOVIE_NO_CYCLE && ev->cycle > c->cycles)
+                key.at = ev->cycle - c->cycles;
+            if(!chip8_input_add(in, &key))
+                break; // the rest comes a frame late, and shows up as a desync
+        }
+        (*next)++;
+    }
+    return in_sync;
+}
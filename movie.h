@@ -0,0 +1,72 @@
+// Input movies: keypad changes by emulated frame, replayed bit-identically
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "input.h"
+
+/* A movie is a text file:
+
+       # chip8 movie
+       seed <rng seed>
+       ipf <instructions per frame>
+       rom <hash of MEMORY after loading the ROM, hex>
+       quirks <quirk spec, see quirks.h>
+       frames <length in emulated frames>
+       <frame> <key 0-F> <1 = down | 0 = up> [cycle [offset]]
+       <frame> ipf <n> [cycle]
+
+   Every header line is optional. Events belong to frame <frame>, in file
+   order. The cycle column, when present, is c->cycles when the event took
+   effect and a mismatch on replay is a desync. A keypad change lands at
+   <offset> opcodes into the frame, the way it was recorded; the offset
+   defaults to where the cycle falls in the frame, and to its start when
+   there is no cycle either (the offset differs from the cycle's position
+   only while FX0A waits, which takes time but runs no opcodes).
+   chip8_batch input scripts are movies without a header. */
+
+#define MOVIE_KEY 0
+#define MOVIE_IPF 1
+#define MOVIE_NO_CYCLE UINT64_MAX
+
+typedef struct {
+    uint32_t frame;
+    uint8_t type; // MOVIE_KEY or MOVIE_IPF
+    uint8_t key, down;
+    int ipf;
+    uint64_t cycle; // MOVIE_NO_CYCLE when not recorded
+    int at; // keys: opcodes into the frame, -1 when not recorded
+} chip8_movie_event_t;
+
+typedef struct {
+    uint32_t seed; // 0 when the movie does not set one
+    int ipf; // 0 when the movie does not set one
+    uint64_t rom_hash; // 0 when the movie does not check it
+    int quirks; // CHIP8_QUIRK_* the movie was recorded with, when has_quirks
+    int has_quirks;
+    uint32_t frames;
+    chip8_movie_event_t *events;
+    int num_events, cap;
+} chip8_movie_t;
+
+int chip8_movie_load(chip8_movie_t *m, const char *path);
+int chip8_movie_save(const chip8_movie_t *m, const char *path);
+void chip8_movie_free(chip8_movie_t *m);
+uint64_t chip8_memory_hash(const chip8_t *c);
+
+// Recording: start right after the ROM is loaded, then log every change with the frame and cycle it took effect at
+void chip8_movie_start(chip8_movie_t *m, const chip8_t *c, int ipf);
+void chip8_movie_key(chip8_movie_t *m, uint32_t frame, const chip8_input_event_t *ev);
+void chip8_movie_ipf(chip8_movie_t *m, uint32_t frame, const chip8_t *c, int ipf);
+// Forget everything from `frame` on, for recording over a rewound stretch
+void chip8_movie_truncate(chip8_movie_t *m, uint32_t frame);
+
+/* Replay: take the events of `frame` from *next on, before it runs. IPF
+   changes update *ipf now; keypad changes go into `in` at the offset their
+   cycle puts them at, for chip8_input_run(). Returns 0 if an IPF change's
+   cycle does not match, keypad changes are checked after the run with
+   chip8_input_in_sync(). */
+int chip8_movie_input(const chip8_movie_t *m, int *next, uint32_t frame, const chip8_t *c, int *ipf, chip8_input_t *in);
+
+#endif
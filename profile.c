@@ -0,0 +1,193 @@
+// Execution profiler: opcode class counts, per-PC hits and call-path samples
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "profile.h"
+
+static const char *op_names[OP_COUNT] = {
+#define X(name, body) #name,
+    CHIP8_OPS(X)
+#undef X
+};
+
+int chip8_profile_enable(chip8_t *c){
+#ifdef CHIP8_PROFILE
+    if(c->profile == NULL && (c->profile = calloc(1, sizeof(chip8_profile_t))) == NULL)
+        return 0;
+    c->profile->path[0] = 0x200;
+    return 1;
+#else
+    (void)c;
+    return 0; // built without CHIP8_PROFILE, the hooks are compiled out
+#endif
+}
+
+void chip8_profile_disable(chip8_t *c){
+    free(c->profile);
+    c->profile = NULL;
+}
+
+// Charge the opcodes run since the last change to the path of depth+1 frames
+static void flush_path(chip8_profile_t *p, int depth){
+    uint64_t insns = p->insns - p->path_since;
+    p->path_since = p->insns;
+    if(insns == 0)
+        return;
+
+    // open addressing on a hash of the path
+    uint32_t hash = 2166136261u;
+    for(int d = 0; d <= depth; d++)
+        hash = (hash ^ p->path[d]) * 16777619u;
+    for(uint32_t slot = hash % PROFILE_SLOTS;; slot = (slot + 1) % PROFILE_SLOTS){
+        int i = p->slots[slot] - 1;
+        if(i < 0)
+            break;
+        profile_stack_t *s = &p->stacks[i];
+        if(s->depth == depth + 1 && memcmp(s->frames, p->path, (depth + 1) * sizeof(uint16_t)) == 0){
+            s->insns += insns;
+            return;
+        }
+    }
+    if(p->num_stacks == PROFILE_STACKS){
+        p->dropped += insns;
+        return;
+    }
+    uint32_t slot = hash % PROFILE_SLOTS;
+    while(p->slots[slot])
+        slot = (slot + 1) % PROFILE_SLOTS;
+    p->slots[slot] = p->num_stacks + 1;
+
+    profile_stack_t *s = &p->stacks[p->num_stacks++];
+    s->depth = depth + 1;
+    memcpy(s->frames, p->path, (depth + 1) * sizeof(uint16_t));
+    s->insns = insns;
+}
+
+void profile_call(chip8_t *c, uint16_t entry){
+    // the caller's path ends here, the callee runs at depth SP
+    chip8_profile_t *p = c->profile;
+    flush_path(p, c->SP - 1);
+    p->path[c->SP] = entry;
+    p->calls++;
+}
+
+void profile_ret(chip8_t *c){
+    flush_path(c->profile, c->SP + 1); // the callee's path ends
+}
+
+static const char *op_group(int op){
+    switch(op){
+        case OP_LD: case OP_ADD: case OP_LD_V: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_V: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL: case OP_RND:
+            return "alu";
+        case OP_DRW: case OP_CLS: case OP_SCD: case OP_SCU: case OP_SCR: case OP_SCL:
+        case OP_LOW: case OP_HIGH: case OP_PLANE:
+            return "draw";
+        case OP_LD_I: case OP_ADD_I: case OP_F_LD: case OP_BCD: case OP_STORE: case OP_READ:
+        case OP_HF_LD: case OP_STORE_FL: case OP_READ_FL: case OP_STORE_R: case OP_READ_R: case OP_LD_I_LONG:
+            return "memory";
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0: case OP_SYS: case OP_EXIT:
+        case OP_SE: case OP_SNE: case OP_SE_V: case OP_SNE_V:
+            return "flow";
+        case OP_SKP: case OP_SKNP: case OP_LD_K: case OP_LD_DT: case OP_DT_LD: case OP_ST_LD:
+        case OP_AUDIO: case OP_PITCH:
+            return "timers_input";
+        default:
+            return "other";
+    }
+}
+
+static void print_path(FILE *f, const profile_stack_t *s){
+    for(int d = 0; d < s->depth; d++)
+        fprintf(f, "%s0x%03X", d ? ";" : "", s->frames[d]);
+}
+
+int chip8_profile_write(chip8_t *c, const char *prefix){
+    chip8_profile_t *p = c->profile;
+    if(p == NULL)
+        return 0;
+    flush_path(p, c->SP < STCK_SIZE ? c->SP : STCK_SIZE - 1);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE *f = fopen(path, "w");
+    if(f == NULL){
+        printf("Error: could not create '%s'\n", path);
+        return 0;
+    }
+    // collapsed stacks, one call path and its opcode count per line (flamegraph.pl, speedscope, ...)
+    for(int i = 0; i < p->num_stacks; i++){
+        print_path(f, &p->stacks[i]);
+        fprintf(f, " %llu\n", (unsigned long long)p->stacks[i].insns);
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    // per-address scratch on the heap, as thread-locals they would cost every thread in the process 1 MB
+    uint8_t *taken = calloc(MEM_SIZE, sizeof(*taken));
+    uint64_t *self = calloc(MEM_SIZE, sizeof(*self)), *total = calloc(MEM_SIZE, sizeof(*total));
+    if(taken == NULL || self == NULL || total == NULL || (f = fopen(path, "w")) == NULL){
+        printf("Error: could not create '%s'\n", path);
+        free(taken);
+        free(self);
+        free(total);
+        return 0;
+    }
+    fprintf(f, "{\n  \"instructions\": %llu,\n  \"calls\": %llu,\n  \"dropped_stack_insns\": %llu,\n",
+            (unsigned long long)p->insns, (unsigned long long)p->calls, (unsigned long long)p->dropped);
+
+    static const char *groups[] = { "alu", "draw", "memory", "flow", "timers_input", "other" };
+    fprintf(f, "  \"groups\": {");
+    for(size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); g++){
+        uint64_t n = 0;
+        for(int op = 0; op < OP_COUNT; op++)
+            if(strcmp(op_group(op), groups[g]) == 0) n += p->op_count[op];
+        fprintf(f, "%s\"%s\": %llu", g ? ", " : "", groups[g], (unsigned long long)n);
+    }
+    fprintf(f, "},\n  \"op_classes\": {");
+    for(int op = 0, first = 1; op < OP_COUNT; op++){
+        if(p->op_count[op] == 0) continue;
+        fprintf(f, "%s\"%s\": %llu", first ? "" : ", ", op_names[op], (unsigned long long)p->op_count[op]);
+        first = 0;
+    }
+
+    // hottest addresses, selection by repeated max is fine for 32 out of MEM_SIZE
+    fprintf(f, "},\n  \"hot_pcs\": [");
+    for(int k = 0; k < 32; k++){
+        int best = -1;
+        for(int pc = 0; pc < MEM_SIZE; pc++)
+            if(!taken[pc] && p->pc_hits[pc] && (best < 0 || p->pc_hits[pc] > p->pc_hits[best])) best = pc;
+        if(best < 0) break;
+        taken[best] = 1;
+        fprintf(f, "%s\n    {\"pc\": \"0x%03X\", \"opcode\": \"%02X%02X\", \"hits\": %llu}", k ? "," : "",
+                best, c->MEMORY[best], c->MEMORY[(best + 1) & MEM_MASK], (unsigned long long)p->pc_hits[best]);
+    }
+
+    // per routine: self is opcodes run in it, total adds everything it called
+    memset(taken, 0, MEM_SIZE * sizeof(*taken));
+    for(int i = 0; i < p->num_stacks; i++){
+        const profile_stack_t *s = &p->stacks[i];
+        self[s->frames[s->depth - 1] & MEM_MASK] += s->insns;
+        for(int d = 0; d < s->depth; d++){
+            int pc = s->frames[d] & MEM_MASK, once = 1;
+            for(int e = 0; e < d; e++)
+                if(s->frames[e] == s->frames[d]) once = 0; // recursive paths count once
+            if(once) total[pc] += s->insns;
+            taken[pc] = 1;
+        }
+    }
+    fprintf(f, "\n  ],\n  \"routines\": [");
+    for(int pc = 0, first = 1; pc < MEM_SIZE; pc++){
+        if(!taken[pc]) continue;
+        fprintf(f, "%s\n    {\"entry\": \"0x%03X\", \"self\": %llu, \"total\": %llu}", first ? "" : ",",
+                pc, (unsigned long long)self[pc], (unsigned long long)total[pc]);
+        first = 0;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    free(taken);
+    free(self);
+    free(total);
+    return 1;
+}
@@ -0,0 +1,51 @@
+// Execution profiler, private to the interpreter core. Only built in with -DCHIP8_PROFILE
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+#define PROFILE_MAX_DEPTH (STCK_SIZE + 1) // the ROM entry plus one frame per stack slot
+#define PROFILE_STACKS 4096 // distinct call paths kept, later ones are counted as dropped
+#define PROFILE_SLOTS (2 * PROFILE_STACKS)
+
+typedef struct {
+    uint8_t depth;
+    uint16_t frames[PROFILE_MAX_DEPTH]; // routine entry addresses, outermost first
+    uint64_t insns; // opcodes executed with exactly this call path
+} profile_stack_t;
+
+typedef struct chip8_profile {
+    uint64_t insns;
+    uint64_t op_count[OP_COUNT];
+    uint64_t pc_hits[MEM_SIZE];
+
+    // current call path, indexed like STACK: path[SP] is the routine running at that depth
+    uint16_t path[PROFILE_MAX_DEPTH];
+    uint64_t path_since; // insns when the path last changed
+    uint64_t calls;
+    profile_stack_t stacks[PROFILE_STACKS];
+    uint16_t slots[PROFILE_SLOTS]; // hash of a path -> index in stacks + 1, 0 when free
+    int num_stacks;
+    uint64_t dropped;
+} chip8_profile_t;
+
+void profile_call(chip8_t *c, uint16_t entry);
+void profile_ret(chip8_t *c);
+
+#ifdef CHIP8_PROFILE
+// every executed opcode, `c->PC` still points at it
+#define PROFILE_INSN(c, op) do { \
+        chip8_profile_t *p_ = (c)->profile; \
+        if(p_){ p_->insns++; p_->op_count[op]++; p_->pc_hits[(c)->PC & MEM_MASK]++; } \
+    } while(0)
+// after CALL pushed or RET popped, SP already updated
+#define PROFILE_CALL(c, entry) do { if((c)->profile) profile_call((c), (entry)); } while(0)
+#define PROFILE_RET(c) do { if((c)->profile) profile_ret(c); } while(0)
+#else
+#define PROFILE_INSN(c, op) ((void)0)
+#define PROFILE_CALL(c, entry) ((void)0)
+#define PROFILE_RET(c) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,123 @@
+// Quirk profiles by name, and a per-ROM database telling which one a ROM needs
+#include <stdio.h>
+#include <string.h>
+#include "quirks.h"
+
+static const struct { const char *name; int bits; } profiles[] = {
+#define X(name, quirks) { #name, quirks },
+    CHIP8_QUIRK_PROFILES(X)
+#undef X
+};
+
+static const struct { const char *name; int bit; const char *what; } quirk_names[] = {
+    { "shift",   CHIP8_QUIRK_SHIFT_VY, "8XY6/8XYE shift Vy into Vx" },
+    { "memi",    CHIP8_QUIRK_MEM_I,    "FX55/FX65 advance I" },
+    { "jump",    CHIP8_QUIRK_JUMP_VX,  "BXNN jumps to XNN + VX" },
+    { "vfreset", CHIP8_QUIRK_VF_RESET, "8XY1/8XY2/8XY3 clear VF" },
+    { "clip",    CHIP8_QUIRK_CLIP,     "sprites clip at the screen edges" },
+};
+#define NUM_PROFILES (int)(sizeof(profiles) / sizeof(profiles[0]))
+#define NUM_QUIRKS (int)(sizeof(quirk_names) / sizeof(quirk_names[0]))
+
+int chip8_quirks_parse(const char *spec){
+    for(int i = 0; i < NUM_PROFILES; i++)
+        if(strcmp(spec, profiles[i].name) == 0)
+            return profiles[i].bits;
+    if(strcmp(spec, "none") == 0)
+        return 0;
+
+    int quirks = 0;
+    const char *p = spec;
+    while(*p){
+        size_t len = strcspn(p, "+");
+        int found = 0;
+        for(int i = 0; i < NUM_QUIRKS; i++){
+            if(strlen(quirk_names[i].name) == len && strncmp(p, quirk_names[i].name, len) == 0){
+                quirks |= quirk_names[i].bit;
+                found = 1;
+            }
+        }
+        if(!found)
+            return -1;
+        p += len;
+        if(*p == '+')
+            p++;
+    }
+    return p == spec ? -1 : quirks;
+}
+
+// quirk names of `quirks` joined by '+'
+static const char *list_quirks(int quirks, char *buf, size_t size){
+    size_t used = 0;
+    buf[0] = '\0';
+    for(int i = 0; i < NUM_QUIRKS; i++)
+        if(quirks & quirk_names[i].bit)
+            used += snprintf(buf + used, used < size ? size - used : 0, "%s%s", used ? "+" : "", quirk_names[i].name);
+    return buf;
+}
+
+const char *chip8_quirks_name(int quirks, char *buf, size_t size){
+    for(int i = 0; i < NUM_PROFILES; i++)
+        if(profiles[i].bits == quirks)
+            return profiles[i].name;
+    return list_quirks(quirks, buf, size);
+}
+
+void chip8_quirks_print(void){
+    char buf[CHIP8_QUIRKS_NAME_MAX];
+    printf("Profiles:\n");
+    for(int i = 0; i < NUM_PROFILES; i++)
+        printf("  %-8s %s\n", profiles[i].name, profiles[i].bits ? list_quirks(profiles[i].bits, buf, sizeof(buf)) : "no quirks");
+    printf("Quirks, joined with '+' (e.g. shift+clip):\n");
+    for(int i = 0; i < NUM_QUIRKS; i++)
+        printf("  %-8s %s\n", quirk_names[i].name, quirk_names[i].what);
+}
+
+/* Find the line for `rom_hash` and split it into the quirk spec and what
+   follows; 1 when found, 0 when there is none and -1 when the file cannot be
+   read. `line_no` is where it was found, for warnings. */
+static int find_entry(const char *db_path, uint64_t rom_hash, char spec[128], char options[128], int *line_no){
+    FILE *f = fopen(db_path, "r");
+    if(f == NULL)
+        return -1;
+    char line[256];
+    unsigned long long hash;
+    int found = 0;
+    *line_no = 0;
+    while(!found && fgets(line, sizeof(line), f)){
+        (*line_no)++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        options[0] = '\0';
+        found = sscanf(line, "%llx %127s %127[^\n]", &hash, spec, options) >= 2 && hash == rom_hash;
+    }
+    fclose(f);
+    return found;
+}
+
+int chip8_quirks_lookup(const char *db_path, uint64_t rom_hash){
+    char spec[128], options[128];
+    int line_no, found = find_entry(db_path, rom_hash, spec, options, &line_no);
+    if(found <= 0)
+        return found - 1;
+    int quirks = chip8_quirks_parse(spec);
+    if(quirks < 0){
+        printf("Warning: %s:%d: unknown quirks '%s'\n", db_path, line_no, spec);
+        return -1;
+    }
+    return quirks;
+}
+
+int chip8_runahead_lookup(const char *db_path, uint64_t rom_hash){
+    char spec[128], options[128], option[128];
+    int line_no, found = find_entry(db_path, rom_hash, spec, options, &line_no);
+    if(found <= 0)
+        return found - 1;
+    int frames = -1, used;
+    for(const char *p = options; sscanf(p, "%127s%n", option, &used) == 1; p += used){
+        if(sscanf(option, "runahead=%d", &frames) != 1 || frames < 0 || frames > CHIP8_RUNAHEAD_MAX){
+            printf("Warning: %s:%d: unknown option '%s'\n", db_path, line_no, option);
+            frames = -1;
+        }
+    }
+    return frames;
+}
@@ -0,0 +1,32 @@
+// Quirk profiles by name, and a per-ROM database telling which one a ROM needs
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/* A quirk spec is a profile name from CHIP8_QUIRK_PROFILES (modern, cosmac,
+   schip, xochip) or quirk names joined by '+': shift, memi, jump, vfreset,
+   clip. "none" is no quirks at all, the same as modern. */
+#define CHIP8_QUIRKS_DB "chip8-quirks.txt" // looked up next to the emulator unless -quirkdb says otherwise
+#define CHIP8_QUIRKS_NAME_MAX 40
+#define CHIP8_RUNAHEAD_MAX 8 // frames of run-ahead a database entry may ask for
+
+// CHIP8_QUIRK_* bits for `spec`, -1 when it is not a profile or quirk list
+int chip8_quirks_parse(const char *spec);
+// The profile name for `quirks`, or its '+' list when no profile has exactly those bits
+const char *chip8_quirks_name(int quirks, char *buf, size_t size);
+// Every profile and quirk name on one line each, for -quirks list
+void chip8_quirks_print(void);
+
+/* The database is a text file of "<rom hash> <quirk spec> [runahead=n]"
+   lines, the hash being chip8_memory_hash() in hex right after the ROM is
+   loaded (the frontend prints it); '#' starts a comment. Returns the quirks
+   listed for `rom_hash`, -1 when there is no entry and -2 when the file
+   cannot be read. */
+int chip8_quirks_lookup(const char *db_path, uint64_t rom_hash);
+// The frames of run-ahead listed for `rom_hash`, -1 when it has none and -2 when the file cannot be read
+int chip8_runahead_lookup(const char *db_path, uint64_t rom_hash);
+
+#endif
@@ -0,0 +1,270 @@
+// Rewind history: per-frame snapshots as XOR + RLE deltas against periodic keyframes
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+#define STATE_WORDS ((CHIP8_STATE_SIZE + 7) / 8)
+#define PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+#define PAGE_WORDS (PAGE_SIZE / 8)
+#define MEMORY_START offsetof(chip8_t, MEMORY)
+#define MEMORY_END (MEMORY_START + MEM_SIZE)
+#define MEMORY_WORD (MEMORY_START / 8)
+#define PAGE_BITS ((MEM_SIZE >> CHIP8_PAGE_SHIFT) / 64)
+_Static_assert(MEMORY_START % 8 == 0, "MEMORY pages are whole state words");
+#define MAX_ENTRIES 65536 // frames of history at most, ~18 minutes at 60 Hz
+
+/* Every snapshot is the machine state XORed with a base, the previous
+   keyframe for deltas and all zeros for keyframes, then run-length encoded
+   in 8-byte words as a sequence of
+
+       uint16_t zero_words, literal_words; uint64_t literal[literal_words];
+
+   Only MEMORY and SCREEN rows that changed since the keyframe cost anything.
+   A delta only copies and scans the MEMORY pages written since its keyframe
+   (chip8_t.rewind_pages), the rest of MEMORY is known to match it. */
+
+typedef struct {
+    uint32_t offset, len; // bytes in the arena
+    uint32_t key; // sequence number of the keyframe this snapshot is relative to
+} entry_t;
+
+struct chip8_rewind {
+    uint8_t *arena;
+    size_t arena_size, used;
+    uint32_t write_pos;
+    int keyframe_interval;
+
+    entry_t entries[MAX_ENTRIES]; // by sequence number modulo MAX_ENTRIES
+    uint32_t oldest, next; // sequence numbers, the ring holds [oldest, next)
+    uint32_t key_seq; // sequence number of the keyframe in key_state
+    int since_key; // snapshots captured since the last keyframe
+    uint64_t key_pages[PAGE_BITS]; // MEMORY pages written since the keyframe
+
+    uint64_t key_state[STATE_WORDS]; // decoded keyframe the newest deltas are relative to
+    uint64_t scratch[STATE_WORDS];
+    uint8_t encoded[STATE_WORDS * 8 + STATE_WORDS * 4 + 4]; // worst case: every other word changed
+};
+
+chip8_rewind_t *chip8_rewind_create(size_t arena_bytes, int keyframe_interval){
+    chip8_rewind_t *r = calloc(1, sizeof(chip8_rewind_t));
+    if(r == NULL)
+        return NULL;
+    r->arena = malloc(arena_bytes);
+    if(r->arena == NULL){
+        free(r);
+        return NULL;
+    }
+    r->arena_size = arena_bytes;
+    r->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : REWIND_KEYFRAME_INTERVAL;
+    return r;
+}
+
+void chip8_rewind_free(chip8_rewind_t *r){
+    if(r == NULL)
+        return;
+    free(r->arena);
+    free(r);
+}
+
+void chip8_rewind_clear(chip8_rewind_t *r){
+    r->oldest = r->next = 0;
+    r->write_pos = 0;
+    r->used = 0;
+    r->since_key = 0;
+}
+
+// Words from `i` on known to match the base: the rest of a MEMORY page not in `pages` (NULL: none)
+static int clean_words(const uint64_t *pages, int i){
+    if(pages == NULL || i < MEMORY_WORD || i >= MEMORY_WORD + MEM_SIZE / 8)
+        return 0;
+    int page = (i - MEMORY_WORD) / PAGE_WORDS;
+    if(pages[page / 64] & (1ULL << (page % 64)))
+        return 0;
+    return PAGE_WORDS - (i - MEMORY_WORD) % PAGE_WORDS;
+}
+
+static size_t encode(uint8_t *out, const uint64_t *state, const uint64_t *base, const uint64_t *pages){
+    uint8_t *p = out;
+    int i = 0;
+    while(i < STATE_WORDS){
+        int start = i;
+        for(;;){
+            int clean = clean_words(pages, i);
+            if(clean)
+                i += clean; // never read, `state` may not even hold it
+            else if(i < STATE_WORDS && state[i] == base[i])
+                i++;
+            else
+                break;
+        }
+        uint16_t zeros = i - start;
+        uint8_t *header = p;
+        p += 4;
+        uint16_t literal = 0;
+        while(i < STATE_WORDS && !clean_words(pages, i) && state[i] != base[i]){
+            uint64_t x = state[i] ^ base[i];
+            memcpy(p, &x, 8);
+            p += 8;
+            literal++;
+            i++;
+        }
+        memcpy(header, &zeros, 2);
+        memcpy(header + 2, &literal, 2);
+    }
+    return p - out;
+}
+
+static void decode(uint64_t *state, const uint8_t *in, size_t len){
+    const uint8_t *end = in + len;
+    int i = 0;
+    while(in < end){
+        uint16_t zeros, literal;
+        memcpy(&zeros, in, 2);
+        memcpy(&literal, in + 2, 2);
+        in += 4;
+        i += zeros;
+        for(int k = 0; k < literal; k++, i++, in += 8){
+            uint64_t x;
+            memcpy(&x, in, 8);
+            state[i] ^= x;
+        }
+    }
+}
+
+static entry_t *entry(chip8_rewind_t *r, uint32_t seq){
+    return &r->entries[seq % MAX_ENTRIES];
+}
+
+static void drop_oldest(chip8_rewind_t *r){
+    // deltas are useless without their keyframe, so they go with it
+    uint32_t key = entry(r, r->oldest)->key;
+    do {
+        r->used -= entry(r, r->oldest)->len;
+        r->oldest++;
+    } while(r->oldest != r->next && entry(r, r->oldest)->key == key);
+}
+
+// Make room for `len` contiguous bytes at write_pos, dropping the oldest history as needed
+static int reserve(chip8_rewind_t *r, uint32_t len){
+    if(len > r->arena_size)
+        return 0;
+    for(;;){
+        if(r->oldest == r->next || r->next - r->oldest == MAX_ENTRIES){
+            if(r->oldest == r->next){
+                r->write_pos = r->write_pos + len <= r->arena_size ? r->write_pos : 0;
+                return 1;
+            }
+            drop_oldest(r);
+            continue;
+        }
+        uint32_t tail = entry(r, r->oldest)->offset;
+        if(tail < r->write_pos){
+            // used bytes are [tail, write_pos), free space is after them and before tail
+            if(r->write_pos + len <= r->arena_size)
+                return 1;
+            if(len <= tail){
+                r->write_pos = 0; // the rest of the arena stays unused this lap
+                continue;
+            }
+        } else if(r->write_pos + len <= tail){
+            // used bytes wrap around, the free space is [write_pos, tail)
+            return 1;
+        }
+        drop_oldest(r);
+    }
+}
+
+static void store(chip8_rewind_t *r, const uint8_t *data, uint32_t len, uint32_t key){
+    memcpy(r->arena + r->write_pos, data, len);
+    entry_t *e = entry(r, r->next);
+    e->offset = r->write_pos;
+    e->len = len;
+    e->key = key;
+    r->write_pos += len;
+    r->used += len;
+    r->next++;
+}
+
+// the keyframe in key_state is still in the ring
+static int key_alive(const chip8_rewind_t *r){
+    return r->oldest != r->next && r->key_seq - r->oldest < r->next - r->oldest;
+}
+
+// Everything of `c` but the MEMORY pages not written since the keyframe into scratch
+static void copy_written(chip8_rewind_t *r, const chip8_t *c){
+    uint8_t *to = (uint8_t *)r->scratch;
+    const uint8_t *from = (const uint8_t *)c;
+    memcpy(to, from, MEMORY_START);
+    memcpy(to + MEMORY_END, from + MEMORY_END, CHIP8_STATE_SIZE - MEMORY_END);
+    for(int w = 0; w < PAGE_BITS; w++){
+        for(uint64_t bits = r->key_pages[w]; bits; bits &= bits - 1){
+            size_t addr = MEMORY_START + ((size_t)(w * 64 + __builtin_ctzll(bits)) << CHIP8_PAGE_SHIFT);
+            memcpy(to + addr, from + addr, PAGE_SIZE);
+        }
+    }
+}
+
+void chip8_rewind_capture(chip8_rewind_t *r, chip8_t *c){
+    r->scratch[STATE_WORDS - 1] = 0; // padding past CHIP8_STATE_SIZE stays zero
+    for(int w = 0; w < PAGE_BITS; w++){
+        r->key_pages[w] |= c->rewind_pages[w];
+        c->rewind_pages[w] = 0;
+    }
+
+    // the newest keyframe may have been dropped to make room, then the next snapshot has to be one
+    if(r->since_key > 0 && r->since_key < r->keyframe_interval && key_alive(r)){
+        copy_written(r, c);
+        uint32_t len = encode(r->encoded, r->scratch, r->key_state, r->key_pages);
+        // making room may drop the keyframe's own group when one interval no longer fits
+        if(reserve(r, len) && key_alive(r)){
+            store(r, r->encoded, len, r->key_seq);
+            r->since_key++;
+            return;
+        }
+    }
+    static const uint64_t zero[STATE_WORDS];
+    memcpy(r->scratch, c, CHIP8_STATE_SIZE);
+    memcpy(r->key_state, r->scratch, sizeof(r->key_state));
+    memset(r->key_pages, 0, sizeof(r->key_pages));
+    r->key_seq = r->next;
+    r->since_key = 1;
+    uint32_t len = encode(r->encoded, r->scratch, zero, NULL);
+    if(reserve(r, len))
+        store(r, r->encoded, len, r->key_seq);
+}
+
+int chip8_rewind_step(chip8_rewind_t *r, chip8_t *c){
+    if(r->next - r->oldest < 2)
+        return 0; // the newest snapshot is the present, keep it
+
+    // drop the present and the space it used
+    r->next--;
+    entry_t *dropped = entry(r, r->next);
+    r->used -= dropped->len;
+    r->write_pos = dropped->offset;
+
+    entry_t *e = entry(r, r->next - 1);
+    if(e->key != r->key_seq){
+        // stepped back past a keyframe, decode the earlier one
+        entry_t *k = entry(r, e->key);
+        memset(r->key_state, 0, sizeof(r->key_state));
+        decode(r->key_state, r->arena + k->offset, k->len);
+        r->key_seq = e->key;
+    }
+    memcpy(r->scratch, r->key_state, sizeof(r->scratch));
+    if(r->next - 1 != e->key)
+        decode(r->scratch, r->arena + e->offset, e->len);
+    r->since_key = r->next - r->key_seq;
+
+    // keep the host caches of `c`, only the machine state goes back in time
+    chip8_restore(c, r->scratch);
+    return 1;
+}
+
+int chip8_rewind_frames(const chip8_rewind_t *r){
+    return r->next - r->oldest;
+}
+
+size_t chip8_rewind_bytes(const chip8_rewind_t *r){
+    return r->used;
+}
@@ -0,0 +1,23 @@
+// Rewind history: per-frame snapshots as XOR + RLE deltas against periodic keyframes
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include "chip8.h"
+
+#define REWIND_KEYFRAME_INTERVAL 60 // one full snapshot per second of emulated time
+
+typedef struct chip8_rewind chip8_rewind_t;
+
+// History kept in an `arena_bytes` ring, the oldest frames are dropped when it is full
+chip8_rewind_t *chip8_rewind_create(size_t arena_bytes, int keyframe_interval);
+void chip8_rewind_free(chip8_rewind_t *r);
+void chip8_rewind_clear(chip8_rewind_t *r);
+// Record the state of `c`, call once per emulated frame; clears c->rewind_pages
+void chip8_rewind_capture(chip8_rewind_t *r, chip8_t *c);
+// Drop the newest snapshot and restore the one before it into `c`, 0 when there is nothing to go back to
+int chip8_rewind_step(chip8_rewind_t *r, chip8_t *c);
+int chip8_rewind_frames(const chip8_rewind_t *r);
+size_t chip8_rewind_bytes(const chip8_rewind_t *r);
+
+#endif
@@ -0,0 +1,109 @@
+// Drift-free fixed-timestep scheduler for the frontend's 60 Hz frames
+#include <time.h>
+#include <math.h>
+#include "sched.h"
+
+#define SPIN_MIN_NS 200000 // never trust the OS to wake us closer than this
+#define SPIN_MAX_NS 4000000
+
+uint64_t sched_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Deadlines are computed from the tick index, so 1/60 s never gets rounded and the error never adds up
+uint64_t sched_deadline(const sched_t *s, int64_t tick){
+    return s->start_ns + tick * 1000000000LL / (int64_t)s->hz;
+}
+
+void sched_init(sched_t *s, uint64_t hz, int max_catch_up){
+    *s = (sched_t){0};
+    s->hz = hz;
+    s->max_catch_up = max_catch_up;
+    s->spin_ns = SPIN_MIN_NS * 5;
+    s->start_ns = sched_now_ns();
+    s->next_ns = s->start_ns;
+    s->interval_min = INT64_MAX;
+}
+
+int sched_ticks_due(sched_t *s){
+    uint64_t now = sched_now_ns();
+    if(now < s->next_ns)
+        return 0;
+
+    int64_t late = now - s->next_ns;
+    s->late_sum += late;
+    if(late > s->late_max) s->late_max = late;
+    if(s->last_tick_ns){
+        int64_t interval = now - s->last_tick_ns;
+        if(interval < s->interval_min) s->interval_min = interval;
+        if(interval > s->interval_max) s->interval_max = interval;
+        s->interval_sum += interval;
+        s->interval_sumsq += (double)interval * interval;
+        s->intervals++;
+    }
+    s->last_tick_ns = now;
+
+    int due = 0;
+    while(now >= s->next_ns && due < s->max_catch_up){
+        s->next_ns = sched_deadline(s, ++s->tick);
+        due++;
+    }
+    if(now >= s->next_ns){
+        // stalled for too long (debugger, suspend): drop the backlog and restart the clock from now
+        uint64_t behind = (now - s->next_ns) * s->hz / 1000000000ULL + 1;
+        s->dropped += behind;
+        s->start_ns = now;
+        s->tick = 1;
+        s->next_ns = sched_deadline(s, 1);
+    }
+    s->ticks += due;
+    return due;
+}
+
+void sched_wait(sched_t *s){
+    uint64_t now = sched_now_ns();
+    if(now >= s->next_ns)
+        return;
+
+    // sleep until shortly before the deadline, learning how late the OS wakes us
+    if(s->next_ns - now > (uint64_t)s->spin_ns){
+        uint64_t target = s->next_ns - s->spin_ns;
+        struct timespec ts = {target / 1000000000ULL, target % 1000000000ULL};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        int64_t over = sched_now_ns() - target;
+        if(over > s->spin_ns) s->spin_ns = over; // overslept, start spinning earlier
+        else s->spin_ns -= (s->spin_ns - over) / 16;
+        if(s->spin_ns < SPIN_MIN_NS) s->spin_ns = SPIN_MIN_NS;
+        if(s->spin_ns > SPIN_MAX_NS) s->spin_ns = SPIN_MAX_NS;
+    }
+    // then spin the last stretch
+    while(sched_now_ns() < s->next_ns)
+        ;
+}
+
+void sched_sleep(sched_t *s){
+    if(sched_now_ns() >= s->next_ns)
+        return;
+    struct timespec ts = {s->next_ns / 1000000000ULL, s->next_ns % 1000000000ULL};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    s->sleeps++;
+}
+
+void sched_print_stats(const sched_t *s, FILE *out){
+    double elapsed = s->last_tick_ns > s->start_ns ? (s->last_tick_ns - s->start_ns) / 1e9 : 0;
+    double mean = s->intervals ? s->interval_sum / s->intervals : 0;
+    double var = s->intervals ? s->interval_sumsq / s->intervals - mean * mean : 0;
+    fprintf(out, "frames: %llu run, %llu dropped\n", (unsigned long long)s->ticks, (unsigned long long)s->dropped);
+    if(s->dropped == 0 && elapsed > 0)
+        fprintf(out, "tick rate: %.4f Hz (target %llu)\n", (s->tick - 1) / elapsed, (unsigned long long)s->hz);
+    if(s->intervals)
+        fprintf(out, "frame time: mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms\n",
+                mean / 1e6, sqrt(var > 0 ? var : 0) / 1e6, s->interval_min / 1e6, s->interval_max / 1e6);
+    if(s->ticks)
+        fprintf(out, "deadline lateness: mean %.1f us, max %.1f us\n",
+                s->late_sum / (s->intervals + 1) / 1e3, s->late_max / 1e3);
+    if(s->sleeps)
+        fprintf(out, "idle: %llu waits slept through without spinning\n", (unsigned long long)s->sleeps);
+}
@@ -0,0 +1,39 @@
+// Drift-free fixed-timestep scheduler for the frontend's 60 Hz frames
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+    uint64_t start_ns; // time of tick 0
+    uint64_t hz; // ticks per second
+    uint64_t tick; // index of the next tick
+    uint64_t next_ns; // deadline of the next tick, start_ns + tick / hz seconds
+    int max_catch_up; // ticks run back to back after a stall, older ones are dropped
+    int64_t spin_ns; // how long before a deadline sleeping stops and spinning starts
+
+    // jitter stats, lateness is how far past its deadline a tick started
+    uint64_t ticks, dropped;
+    uint64_t last_tick_ns;
+    int64_t late_max;
+    double late_sum;
+    int64_t interval_min, interval_max; // host time between frames, ticks run together count once
+    double interval_sum, interval_sumsq;
+    uint64_t intervals;
+    uint64_t sleeps; // waits done by sched_sleep()
+} sched_t;
+
+uint64_t sched_now_ns(void);
+// When tick `tick` is due; tick - 1 to tick is the stretch of host time that tick's frame stands for
+uint64_t sched_deadline(const sched_t *s, int64_t tick);
+void sched_init(sched_t *s, uint64_t hz, int max_catch_up);
+// Number of ticks that are due now (at most max_catch_up), each one is consumed
+int sched_ticks_due(sched_t *s);
+// Sleep, then spin, until the next tick is due
+void sched_wait(sched_t *s);
+// Only sleep, for when the next tick may start a little late: no CPU spent spinning
+void sched_sleep(sched_t *s);
+void sched_print_stats(const sched_t *s, FILE *out);
+
+#endif
@@ -0,0 +1,50 @@
+// In-memory snapshots for run-ahead, see snapshot.h
+#include <string.h>
+#include "snapshot.h"
+#include "bcache.h"
+
+#define PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+#define MEMORY_START offsetof(chip8_t, MEMORY)
+#define MEMORY_END (MEMORY_START + MEM_SIZE)
+
+/* Copy the pages written since the last take or restore from one MEMORY to
+   the other and clear their bits. Restoring skips pages that were written
+   back to what they held, the code decoded from them is still good. */
+static void copy_pages(chip8_t *c, uint8_t *to, const uint8_t *from, int restoring){
+    for(int w = 0; w < (int)(sizeof(c->written_pages) / sizeof(c->written_pages[0])); w++){
+        uint64_t bits = c->written_pages[w];
+        c->written_pages[w] = 0;
+        while(bits){
+            int addr = (w * 64 + __builtin_ctzll(bits)) << CHIP8_PAGE_SHIFT;
+            bits &= bits - 1;
+            if(restoring && memcmp(to + addr, from + addr, PAGE_SIZE) == 0)
+                continue;
+            memcpy(to + addr, from + addr, PAGE_SIZE);
+            if(restoring)
+                bcache_written(c, addr, PAGE_SIZE);
+        }
+    }
+}
+
+void chip8_snapshot_take(chip8_snapshot_t *s, chip8_t *c){
+    const uint8_t *state = (const uint8_t *)c;
+    memcpy(s->state, state, MEMORY_START);
+    memcpy(s->state + MEMORY_END, state + MEMORY_END, CHIP8_STATE_SIZE - MEMORY_END);
+    if(s->owner != c){
+        memcpy(s->state + MEMORY_START, c->MEMORY, MEM_SIZE);
+        memset(c->written_pages, 0, sizeof(c->written_pages));
+        s->owner = c;
+    } else
+        copy_pages(c, s->state + MEMORY_START, c->MEMORY, 0);
+}
+
+void chip8_snapshot_restore(chip8_snapshot_t *s, chip8_t *c){
+    uint8_t *state = (uint8_t *)c;
+    if(s->owner != c){
+        chip8_restore(c, s->state); // taken from another machine, its pages say nothing about this one
+        return;
+    }
+    memcpy(state, s->state, MEMORY_START);
+    memcpy(state + MEMORY_END, s->state + MEMORY_END, CHIP8_STATE_SIZE - MEMORY_END);
+    copy_pages(c, c->MEMORY, s->state + MEMORY_START, 1);
+}
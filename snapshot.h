@@ -0,0 +1,25 @@
+// In-memory snapshots for run-ahead: take and restore cost a few KB of copying, not all of MEMORY
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "chip8.h"
+
+/* The machine state as of chip8_snapshot_take(). MEMORY is only copied in
+   the pages written since the snapshot last matched the machine (see
+   chip8_t.written_pages), everything else in the state is a couple of KB
+   copied whole. That makes one snapshot per machine the limit: taking or
+   restoring clears the written bits, so a second snapshot of the same
+   machine would miss pages. The first take after using the snapshot with
+   another machine copies all of MEMORY. */
+typedef struct {
+    uint8_t state[CHIP8_STATE_SIZE];
+    const chip8_t *owner; // the machine `state` mirrors the MEMORY of, NULL before the first take
+} chip8_snapshot_t;
+
+void chip8_snapshot_take(chip8_snapshot_t *s, chip8_t *c);
+/* Put `c` back as it was at the last take, leaving the host-side caches be:
+   only blocks and native code built from the pages written since are dropped,
+   unlike chip8_restore() which starts them over. */
+void chip8_snapshot_restore(chip8_snapshot_t *s, chip8_t *c);
+
+#endif
@@ -0,0 +1,91 @@
+// Versioned binary save states: one writev to save, mmap + validate + memcpy to load
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+
+static uint32_t state_checksum(const void *data, size_t size){
+    const uint8_t *p = data;
+    uint32_t hash = 0x811c9dc5;
+    for(size_t i = 0; i < size; i++){
+        hash ^= p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/* The checksum only catches damage, anyone can recompute it for an edited
+   file: fields used as indices or flags must still be in range. */
+static int state_valid(const chip8_t *s){
+    return s->key_dest >= 0 && s->key_dest < 16 && s->SP < STCK_SIZE &&
+           s->key_press_buffer >= -1 && s->key_press_buffer < 16 &&
+           (s->waiting_for_key == 0 || s->waiting_for_key == 1) && (s->halted == 0 || s->halted == 1) &&
+           s->hires <= 1 && s->planes <= 3;
+}
+
+int chip8_save_state(const chip8_t *c, const char *path){
+    // header and state go out in a single writev so a crash never leaves half a header
+    chip8_state_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_STATE_MAGIC, 4);
+    header.version = CHIP8_STATE_VERSION;
+    header.size = CHIP8_STATE_SIZE;
+    header.checksum = state_checksum(c, CHIP8_STATE_SIZE);
+    struct iovec file[2] = { { &header, sizeof(header) }, { (void *)c, CHIP8_STATE_SIZE } };
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("Error: could not create save state '%s'\n", path);
+        return 0;
+    }
+    ssize_t written = writev(fd, file, 2);
+    close(fd);
+    if(written != (ssize_t)(sizeof(header) + CHIP8_STATE_SIZE)){
+        printf("Error: could not write save state '%s'\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+int chip8_load_state(chip8_t *c, const char *path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("Error: could not open save state '%s'\n", path);
+        return 0;
+    }
+    struct stat st;
+    size_t size = sizeof(chip8_state_header_t) + CHIP8_STATE_SIZE;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size != size){
+        printf("Error: '%s' is not a save state of this build (%ld bytes, expected %zu)\n", path, (long)st.st_size, size);
+        close(fd);
+        return 0;
+    }
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        printf("Error: could not map save state '%s'\n", path);
+        return 0;
+    }
+
+    const chip8_state_header_t *h = (const chip8_state_header_t *)map;
+    const uint8_t *state = map + sizeof(*h);
+    int ok = 0;
+    if(memcmp(h->magic, CHIP8_STATE_MAGIC, 4) != 0)
+        printf("Error: '%s' is not a save state\n", path);
+    else if(h->version != CHIP8_STATE_VERSION || h->size != CHIP8_STATE_SIZE)
+        printf("Error: save state '%s' is version %u, this build reads version %u\n", path, h->version, CHIP8_STATE_VERSION);
+    else if(h->checksum != state_checksum(state, CHIP8_STATE_SIZE))
+        printf("Error: save state '%s' is corrupt\n", path);
+    else if(!state_valid((const chip8_t *)state)) // 16-byte header, the state stays aligned
+        printf("Error: save state '%s' holds an impossible machine\n", path);
+    else {
+        chip8_restore(c, state);
+        ok = 1;
+    }
+    munmap((void *)map, size);
+    return ok;
+}
@@ -0,0 +1,152 @@
+// Binary execution trace: the emulator fills a single-producer single-consumer ring, a writer thread empties it
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "trace.h"
+
+_Static_assert(sizeof(chip8_trace_record_t) == 32, "trace records are written as raw 32-byte structs");
+
+struct chip8_trace {
+    chip8_trace_record_t ring[TRACE_RING_RECORDS];
+    // producer and consumer indices on their own cache lines, they only ever grow
+    _Alignas(64) _Atomic uint64_t head; // next record the emulator writes
+    _Alignas(64) _Atomic uint64_t tail; // next record the writer saves
+    _Alignas(64) _Atomic int stop;
+    uint64_t stalls;
+    int fd;
+    int failed;
+    const char *path;
+    pthread_t thread;
+};
+
+static int write_all(int fd, const void *data, size_t size){
+    const uint8_t *p = data;
+    while(size > 0){
+        ssize_t n = write(fd, p, size);
+        if(n <= 0)
+            return 0;
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+static void *writer_main(void *arg){
+    chip8_trace_t *t = arg;
+    uint64_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    for(;;){
+        int stopping = atomic_load_explicit(&t->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+        if(head == tail){
+            if(stopping)
+                break;
+            // nothing queued, let a few thousand records pile up instead of writing them one by one
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        // one write per contiguous span of the ring
+        uint64_t start = tail % TRACE_RING_RECORDS;
+        uint64_t n = head - tail;
+        if(n > TRACE_RING_RECORDS - start)
+            n = TRACE_RING_RECORDS - start;
+        if(!t->failed && !write_all(t->fd, &t->ring[start], n * sizeof(chip8_trace_record_t))){
+            printf("Error: could not write trace '%s', the rest is discarded\n", t->path);
+            t->failed = 1; // keep draining so the emulator never blocks on a dead file
+        }
+        tail += n;
+        atomic_store_explicit(&t->tail, tail, memory_order_release);
+        if(n < TRACE_WRITE_CHUNK && !stopping){
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+chip8_trace_t *chip8_trace_open(const char *path){
+    chip8_trace_t *t = calloc(1, sizeof(chip8_trace_t));
+    if(t == NULL)
+        return NULL;
+    t->path = path;
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(t->fd < 0){
+        printf("Error: could not create trace '%s'\n", path);
+        free(t);
+        return NULL;
+    }
+    chip8_trace_header_t header = { .version = CHIP8_TRACE_VERSION, .record_size = sizeof(chip8_trace_record_t) };
+    memcpy(header.magic, CHIP8_TRACE_MAGIC, 4);
+    if(!write_all(t->fd, &header, sizeof(header)) || pthread_create(&t->thread, NULL, writer_main, t) != 0){
+        printf("Error: could not start trace '%s'\n", path);
+        close(t->fd);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void chip8_trace_close(chip8_trace_t *t){
+    if(t == NULL)
+        return;
+    atomic_store_explicit(&t->stop, 1, memory_order_release);
+    pthread_join(t->thread, NULL);
+    close(t->fd);
+    free(t);
+}
+
+int chip8_trace_step(chip8_trace_t *t, chip8_t *c){
+    if(c->halted || c->waiting_for_key)
+        return chip8_cycle(c); // no opcode runs, nothing to log
+
+    uint16_t pc = c->PC;
+    uint16_t opcode = c->MEMORY[pc & MEM_MASK] << 8 | c->MEMORY[(pc + 1) & MEM_MASK];
+    uint64_t cycle = c->cycles;
+    int ran = chip8_cycle(c);
+    if(!ran)
+        return ran;
+
+    uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&t->tail, memory_order_acquire) == TRACE_RING_RECORDS){
+        // the writer fell a whole ring behind, wait rather than lose records
+        t->stalls++;
+        while(head - atomic_load_explicit(&t->tail, memory_order_acquire) == TRACE_RING_RECORDS)
+            sched_yield();
+    }
+    chip8_trace_record_t *r = &t->ring[head % TRACE_RING_RECORDS];
+    r->cycle = cycle;
+    r->pc = pc;
+    r->opcode = opcode;
+    r->I = c->I;
+    r->SP = c->SP;
+    r->DT = c->DT;
+    memcpy(r->V, c->V, sizeof(r->V));
+    atomic_store_explicit(&t->head, head + 1, memory_order_release);
+    return ran;
+}
+
+int chip8_trace_run(chip8_trace_t *t, chip8_t *c, int cycles){
+    int executed = 0;
+    while(executed < cycles && !c->halted){
+        if(chip8_trace_step(t, c))
+            executed++;
+        else if(c->waiting_for_key)
+            break; // a resolved FX0A returns 0 without waiting, keep going then
+    }
+    return executed;
+}
+
+uint64_t chip8_trace_records(const chip8_trace_t *t){
+    return atomic_load_explicit(&t->head, memory_order_relaxed);
+}
+
+uint64_t chip8_trace_stalls(const chip8_trace_t *t){
+    return t->stalls;
+}
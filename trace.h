@@ -0,0 +1,48 @@
+// Binary execution trace: fixed-size records through a lock-free ring, written by a background thread
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+/* A trace file is a chip8_trace_header_t followed by one chip8_trace_record_t
+   per executed opcode, little-endian as laid out in memory. Each record holds
+   the registers after the opcode ran, so the changes an opcode made are the
+   difference to the record before it. chip8_trace (make trace) prints a trace
+   as text or finds the first record where two traces differ. */
+
+#define CHIP8_TRACE_MAGIC "C8TR"
+#define CHIP8_TRACE_VERSION 1
+#define TRACE_RING_RECORDS (1 << 16) // 2 MB between the emulator and the writer
+#define TRACE_WRITE_CHUNK 4096 // records per write() once the writer is behind
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} chip8_trace_header_t;
+
+typedef struct {
+    uint64_t cycle; // c->cycles before the opcode
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t SP;
+    uint8_t DT;
+    uint8_t V[16];
+} chip8_trace_record_t; // 32 bytes, no padding
+
+typedef struct chip8_trace chip8_trace_t;
+
+// Create `path` and start the writer thread, NULL on failure
+chip8_trace_t *chip8_trace_open(const char *path);
+// Drain the ring, stop the writer and close the file
+void chip8_trace_close(chip8_trace_t *t);
+// chip8_cycle() that also logs the opcode it executed. Waits for the writer when the ring is full
+int chip8_trace_step(chip8_trace_t *t, chip8_t *c);
+// chip8_run() one logged opcode at a time, same return value and early stops
+int chip8_trace_run(chip8_trace_t *t, chip8_t *c, int cycles);
+uint64_t chip8_trace_records(const chip8_trace_t *t);
+uint64_t chip8_trace_stalls(const chip8_trace_t *t); // times the emulator found the ring full
+
+#endif
@@ -0,0 +1,120 @@
+// Offline reader for binary execution traces: print one as text or find where two of them diverge
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "trace.h"
+
+#define DIFF_CONTEXT 8 // records shown before the first difference
+
+static FILE *open_trace(const char *path){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        fprintf(stderr, "Error: could not open trace '%s'\n", path);
+        return NULL;
+    }
+    static char buffers[2][1 << 20];
+    static int next_buffer = 0;
+    setvbuf(f, buffers[next_buffer++ & 1], _IOFBF, sizeof(buffers[0]));
+
+    chip8_trace_header_t header;
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, CHIP8_TRACE_MAGIC, 4) != 0){
+        fprintf(stderr, "Error: '%s' is not a trace\n", path);
+        fclose(f);
+        return NULL;
+    }
+    if(header.version != CHIP8_TRACE_VERSION || header.record_size != sizeof(chip8_trace_record_t)){
+        fprintf(stderr, "Error: trace '%s' has version %u, this tool reads version %u\n", path, header.version, CHIP8_TRACE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+// One line per record: cycle, address, opcode and the registers it changed
+static void print_record(FILE *out, const chip8_trace_record_t *r, const chip8_trace_record_t *prev){
+    fprintf(out, "%10llu  %03X  %04X ", (unsigned long long)r->cycle, r->pc, r->opcode);
+    for(int i = 0; i < 16; i++)
+        if(prev == NULL || r->V[i] != prev->V[i])
+            fprintf(out, " V%X=%02X", i, r->V[i]);
+    if(prev == NULL || r->I != prev->I)
+        fprintf(out, " I=%03X", r->I);
+    if(prev == NULL || r->SP != prev->SP)
+        fprintf(out, " SP=%u", r->SP);
+    if(prev == NULL || r->DT != prev->DT)
+        fprintf(out, " DT=%u", r->DT);
+    fprintf(out, "\n");
+}
+
+static int dump(const char *path){
+    FILE *f = open_trace(path);
+    if(f == NULL)
+        return 1;
+    chip8_trace_record_t r, prev;
+    int have_prev = 0;
+    while(fread(&r, sizeof(r), 1, f) == 1){
+        print_record(stdout, &r, have_prev ? &prev : NULL);
+        prev = r;
+        have_prev = 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static void print_fields(const char *name, const chip8_trace_record_t *r){
+    printf("  %s: cycle %llu pc %03X opcode %04X I=%03X SP=%u DT=%u V=",
+           name, (unsigned long long)r->cycle, r->pc, r->opcode, r->I, r->SP, r->DT);
+    for(int i = 0; i < 16; i++)
+        printf("%02X", r->V[i]);
+    printf("\n");
+}
+
+static int diff(const char *path_a, const char *path_b){
+    FILE *a = open_trace(path_a), *b = open_trace(path_b);
+    if(a == NULL || b == NULL)
+        return 2;
+
+    // the last DIFF_CONTEXT records both traces agreed on
+    chip8_trace_record_t history[DIFF_CONTEXT], ra, rb;
+    uint64_t index = 0;
+    int result = 0;
+    for(;; index++){
+        int got_a = fread(&ra, sizeof(ra), 1, a) == 1;
+        int got_b = fread(&rb, sizeof(rb), 1, b) == 1;
+        if(!got_a && !got_b){
+            printf("Traces are identical, %llu records\n", (unsigned long long)index);
+            break;
+        }
+        if(got_a && got_b && memcmp(&ra, &rb, sizeof(ra)) == 0){
+            history[index % DIFF_CONTEXT] = ra;
+            continue;
+        }
+
+        result = 1;
+        uint64_t first = index > DIFF_CONTEXT ? index - DIFF_CONTEXT : 0;
+        printf("Traces diverge at record %llu\n", (unsigned long long)index);
+        for(uint64_t i = first; i < index; i++)
+            print_record(stdout, &history[i % DIFF_CONTEXT], i > first ? &history[(i - 1) % DIFF_CONTEXT] : NULL);
+        if(!got_a || !got_b){
+            printf("  %s ends here\n", got_a ? path_b : path_a);
+            print_fields(got_a ? path_a : path_b, got_a ? &ra : &rb);
+        } else {
+            print_fields(path_a, &ra);
+            print_fields(path_b, &rb);
+        }
+        break;
+    }
+    fclose(a);
+    fclose(b);
+    return result;
+}
+
+int main(int argc, char* argv[]){
+    if(argc == 2 && argv[1][0] != '-')
+        return dump(argv[1]);
+    if(argc == 4 && strcmp(argv[1], "-diff") == 0)
+        return diff(argv[2], argv[3]);
+    printf("Usage: %s trace.c8t              print every record as text\n", argv[0]);
+    printf("       %s -diff a.c8t b.c8t      show the first record where two traces differ\n", argv[0]);
+    return 2;
+}